@@ -25,6 +25,10 @@
 #error CHAR_BIT must be 8 for utf8chk
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum utf8chk_error {
     /* Continuation byte found when not expected.
        The error pointer points to the continuation byte.
@@ -165,6 +169,24 @@ typedef enum utf8chk_error {
        Requires the validation flag UTF8CHK_CHECK_SURROGATES. */
     UTF8CHK_ERR_SURROGATE_TRUNC3 = 50,
 
+    /* The output buffer is full. Only returned by the functions
+       that write output, such as utf8chk_decode32.
+       The error pointer points to the start of the first sequence
+       that did not fit, or to the high surrogate of a surrogate pair
+       that did not fit. The error length will be set to 0.
+       The output written so far is complete, and decoding may continue
+       from the error pointer with more room. */
+    UTF8CHK_ERR_NO_SPACE = 64,
+
+    /* A valid code point that the output encoding cannot represent.
+       Only returned by the functions that write output in an encoding
+       narrower than Unicode, such as utf8chk_to_latin1.
+       The error pointer points to the start of the byte sequence
+       encoding the code point (for a surrogate pair, the high surrogate).
+       The error length will be set to the length of that sequence.
+       The output written so far is complete. */
+    UTF8CHK_ERR_UNREPRESENTABLE = 65,
+
     /* No error.
        The error pointer is set to the end of the string, either
        due to length or due to a null terminator (depending on the
@@ -266,6 +288,56 @@ extern utf8chk_error_t utf8chk(const char *string, size_t length,
             utf8chk_flag_t flags, const char **error_at, size_t *error_len);
 #endif
 
+/** Returns the name of an error code, such as "UTF8CHK_ERR_TRUNC" for
+    UTF8CHK_ERR_TRUNC, or "<???>" if it is not one. */
+#ifndef UTF8CHK_STATIC
+extern const char *utf8chk_strerr(utf8chk_error_t err);
+#endif
+
+/** The same as utf8chk with the flags fixed to one of the presets, which
+    are compiled into the validation loop instead of tested as the string
+    is read. utf8chk calls these when given a preset as is.
+    
+    The _cstr variants take a null-terminated string. The others take the
+    length of the string, and also accept UTF8CHK_CSTRING. */
+#ifndef UTF8CHK_STATIC
+extern utf8chk_error_t utf8chk_lax(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_lax_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_utf8(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_utf8_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_mutf8(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_mutf8_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_cesu8(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_cesu8_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_wtf8(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_wtf8_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_strict(const char *string, size_t length,
+            const char **error_at, size_t *error_len);
+extern utf8chk_error_t utf8chk_strict_cstr(const char *string,
+            const char **error_at, size_t *error_len);
+#endif
+
+/** Returns whether the string is valid with the given flags: nonzero if
+    utf8chk would return UTF8CHK_OK for it, and zero otherwise. Nothing is
+    said about where the error is, which lets the string be checked in
+    blocks, without stopping at every byte to see whether it was valid.
+    Only if a block looks wrong does utf8chk_valid call utf8chk to make
+    sure. The length may be UTF8CHK_CSTRING. */
+#ifndef UTF8CHK_STATIC
+extern int utf8chk_valid(const char *string, size_t length,
+            utf8chk_flag_t flags);
+#endif
+
 #if UINT_MAX / 10000 > 10000
 typedef unsigned int utf8chk_uchar_t;
 #else
@@ -274,8 +346,518 @@ typedef unsigned long utf8chk_uchar_t;
 
 #define UTF8CHK_UCHAR(u) (utf8chk_uchar_t)(u##UL)
 
+/* a UTF-16 code unit. */
+typedef unsigned short utf8chk_char16_t;
+
+/* State carried from one sequence to the next during validation.
+   The fields are private. */
+typedef struct utf8chk_state {
+    /* cached codepoint from high surrogate. */
+    utf8chk_uchar_t u_cache;
+    /* length of the last sequence. */
+    unsigned n_prev;
+    /* whether to allow low surrogates. set if and only if the
+       preceding code point was a high surrogate. */
+    int expect_low_surrogate;
+} utf8chk_state_t;
+
+/* A stream being validated a chunk at a time;
+   see utf8chk_stream_init. The fields are private. */
+typedef struct utf8chk_stream {
+    /* state after the last complete sequence. */
+    utf8chk_state_t state;
+    /* validation flags. */
+    utf8chk_flag_t flags;
+    /* number of bytes fed so far. */
+    size_t offset;
+    /* the first error found, reported again by every later call. */
+    utf8chk_error_t error;
+    size_t error_at;
+    size_t error_len;
+    /* a sequence cut off by the end of the last chunk. */
+    unsigned char pending[4];
+    unsigned n_pending;
+} utf8chk_stream_t;
+
+#ifndef UTF8CHK_STATIC
+/** Prepares a stream for validation with the given flags.
+    The stream is then fed with utf8chk_stream_feed any number of times,
+    and finally ended with utf8chk_stream_finish. */
+extern void utf8chk_stream_init(utf8chk_stream_t *stream,
+            utf8chk_flag_t flags);
+
+/** Validates the next chunk of a stream. Every byte is scanned once,
+    and the chunk is not needed after the call returns; a sequence cut
+    off at the end of the chunk is kept in the stream and completed by
+    the bytes of the next chunk. length must be the length of the chunk
+    (UTF8CHK_CSTRING is not supported).
+
+    Returns UTF8CHK_OK if no errors have been found so far, otherwise
+    one of the values of enum utf8chk_error (UTF8CHK_ERR_*), which is
+    returned again by every later call. The errors are the same as
+    utf8chk would report for the entire stream at once, except that
+    the truncation errors (UTF8CHK_ERR_TRUNC* and
+    UTF8CHK_ERR_SURROGATE_TRUNC*) are only reported by
+    utf8chk_stream_finish.
+
+    If error_at is not NULL, the error offset is stored there. It is
+    counted from the first byte of the stream, not of the chunk,
+    and is the number of bytes fed so far if there was no error.
+    If error_len is not NULL, the error length is stored there. */
+extern utf8chk_error_t utf8chk_stream_feed(utf8chk_stream_t *stream,
+            const char *chunk, size_t length,
+            size_t *error_at, size_t *error_len);
+
+/** Ends a stream. Returns the first error in the stream, including
+    the truncation errors for a sequence or surrogate pair left
+    incomplete at the end, or UTF8CHK_OK if the stream was valid.
+    error_at and error_len are set as by utf8chk_stream_feed. */
+extern utf8chk_error_t utf8chk_stream_finish(utf8chk_stream_t *stream,
+            size_t *error_at, size_t *error_len);
+#endif
+
+/* A job run by an executor; see utf8chk_executor_t. */
+typedef void (*utf8chk_job_t)(void *arg, size_t index);
+
+/* Runs job(arg, index) once for every index from 0 to count - 1,
+   in any order and possibly in parallel, and returns once they
+   have all finished. context is passed through from utf8chk_parallel. */
+typedef void (*utf8chk_executor_t)(void *context, utf8chk_job_t job,
+                                   void *arg, size_t count);
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk, but split into up to threads chunks
+    that are validated in parallel. The result is exactly the same as that
+    of utf8chk, including the position of the first error.
+
+    The chunks are run by calling executor with context, which lets the
+    caller run them on a thread pool of its own. If executor is NULL,
+    the chunks are run on threads created for the call if UTF8CHK_THREADS
+    is defined (which requires POSIX threads), and one after another in
+    the calling thread otherwise.
+
+    Short strings and null-terminated strings (UTF8CHK_CSTRING) are
+    validated in the calling thread. */
+extern utf8chk_error_t utf8chk_parallel(const char *string, size_t length,
+            utf8chk_flag_t flags, const char **error_at, size_t *error_len,
+            unsigned threads, utf8chk_executor_t executor, void *context);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk, and decodes it into code points
+    in the same pass. The code points are written to out, which has room
+    for out_size of them, and the number written is stored in *out_len
+    if out_len is not NULL.
+
+    With UTF8CHK_CHECK_SURROGATES, a surrogate pair is combined into the
+    code point that it encodes, while a high surrogate that is not followed
+    by a low one is written as is. Without it, any surrogates (which are
+    then not banned) are also written as is.
+
+    Returns the same errors as utf8chk, in which case the code points
+    before the error have been written, or UTF8CHK_ERR_NO_SPACE if out
+    runs out of room. Decoding can always continue from the error pointer
+    with room for two more code points. */
+extern utf8chk_error_t utf8chk_decode32(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_uchar_t *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len);
+#endif
+
+/* the number of code points decoded into an iterator at a time. Must be
+   at least 2, and the same in every compilation unit. */
+#ifndef UTF8CHK_ITER_BUFFER
+#define UTF8CHK_ITER_BUFFER 64
+#endif
+#if UTF8CHK_ITER_BUFFER < 2
+#error UTF8CHK_ITER_BUFFER must be at least 2
+#endif
+
+/* stored by utf8chk_iter_next when there are no more code points. */
+#define UTF8CHK_ITER_END ((utf8chk_uchar_t)-1)
+
+/* An iterator over the code points of a string;
+   see utf8chk_iter_init. The fields are private. */
+typedef struct utf8chk_iter {
+    /* the rest of the string, not yet decoded. */
+    const char *string;
+    size_t length;
+    /* validation flags. */
+    utf8chk_flag_t flags;
+    /* set once the string has been decoded up to its end or an error. */
+    int done;
+    /* the error ending the string, or UTF8CHK_OK at its end. */
+    utf8chk_error_t error;
+    const char *error_at;
+    size_t error_len;
+    /* code points decoded, of which those from next on are still to
+       be returned. */
+    unsigned next;
+    unsigned count;
+    utf8chk_uchar_t buffer[UTF8CHK_ITER_BUFFER];
+} utf8chk_iter_t;
+
+#ifndef UTF8CHK_STATIC
+/** Prepares an iterator over the code points of a string, which is
+    validated with the given flags as the iterator gets to it. The string
+    must stay in place until the iterator is no longer used. */
+extern void utf8chk_iter_init(utf8chk_iter_t *iter, const char *string,
+            size_t length, utf8chk_flag_t flags);
+
+/** Stores the next code point of the string in *u and returns UTF8CHK_OK.
+    The code points are those that utf8chk_decode32 writes, decoded
+    UTF8CHK_ITER_BUFFER at a time, so most calls only take one out
+    of the iterator.
+
+    Once there are no more code points, stores UTF8CHK_ITER_END in *u and
+    returns UTF8CHK_OK at the end of a valid string, or otherwise the first
+    error in it, as returned by utf8chk. Only then are error_at and
+    error_len (if not NULL) set, as by utf8chk. Every later call does
+    the same again. */
+extern utf8chk_error_t utf8chk_iter_next(utf8chk_iter_t *iter,
+            utf8chk_uchar_t *u, const char **error_at, size_t *error_len);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk while copying it to dest, which must
+    have room for length bytes and must not overlap the string. length
+    must be the length of the string (UTF8CHK_CSTRING is not supported).
+    The string is validated a block at a time, and each block is copied
+    while it is still in the cache, so the string is only read from
+    memory once.
+
+    Returns the same errors as utf8chk. If error_at is not NULL, the error
+    offset is stored there, counted from the start of the string, and is
+    length if the string is valid. If error_len is not NULL, the error
+    length is stored there. The bytes before the error offset have been
+    copied to dest; the contents of the rest of it are unspecified. */
+extern utf8chk_error_t utf8chk_copy(char *dest, const char *string,
+            size_t length, utf8chk_flag_t flags,
+            size_t *error_at, size_t *error_len);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk, and transcodes it into UTF-16 code
+    units in the same pass. The code units are written to out, which has
+    room for out_size of them, and the number written is stored in *out_len
+    if out_len is not NULL.
+
+    Surrogates (allowed by UTF8CHK_CHECK_SURROGATES, or by leaving out
+    UTF8CHK_BAN_SURROGATES) are written as the code units they encode,
+    so CESU-8 and MUTF-8 surrogate pairs come out as the same pairs.
+    Four-byte sequences are written as surrogate pairs.
+
+    Returns the same errors as utf8chk, in which case the code units for
+    the string before the error have been written, or UTF8CHK_ERR_NO_SPACE
+    if out runs out of room. Transcoding can always continue from the error
+    pointer with room for two more code units. */
+extern utf8chk_error_t utf8chk_to_utf16(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_char16_t *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len);
+
+/** Validates a string like utf8chk, and stores the number of UTF-16
+    code units utf8chk_to_utf16 would write for it in *out_len if out_len
+    is not NULL. If the string has an error, the count is for the string
+    before the error. */
+extern utf8chk_error_t utf8chk_utf16_length(const char *string,
+            size_t length, utf8chk_flag_t flags, size_t *out_len,
+            const char **error_at, size_t *error_len);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk, and narrows it into Latin-1
+    (ISO 8859-1) in the same pass, or into ASCII if ascii is nonzero.
+    The bytes are written to out, which has room for out_size of them,
+    and the number written is stored in *out_len if out_len is not NULL.
+    A string never narrows into more bytes than it has.
+
+    Returns the same errors as utf8chk, or UTF8CHK_ERR_UNREPRESENTABLE
+    at the first code point above U+00FF (or U+007F for ASCII), whichever
+    comes first, in which case the string before the error has been
+    written; or UTF8CHK_ERR_NO_SPACE if out runs out of room. Narrowing
+    can always continue from the error pointer with room for one more
+    byte. */
+extern utf8chk_error_t utf8chk_to_latin1(const char *string, size_t length,
+            utf8chk_flag_t flags, int ascii, char *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len);
+#endif
+
+/* The error codes are all less than this. */
+#define UTF8CHK_ERR_LIMIT 66
+
+#ifndef UTF8CHK_STATIC
+/** Repairs a string, replacing each error with U+FFFD REPLACEMENT
+    CHARACTER (EF BF BD) in one pass. The repaired string is valid
+    with the given flags.
+
+    Errors are replaced by maximal subparts: each U+FFFD replaces the
+    longest run of bytes that could start a sequence allowed by flags,
+    or a single byte if there is none. A whole sequence is replaced if
+    it is only rejected for what it encodes (a noncharacter or a surrogate
+    not paired as required), including a high surrogate left unpaired by
+    another high surrogate or by the end of the string.
+
+    The repaired string is written to out, which has room for out_size
+    bytes, and its length is stored in *out_len if out_len is not NULL.
+    It is not null-terminated. If out is NULL, nothing is written, and
+    only the length is stored. out may also be string itself, with
+    out_size at least the length of the string, to repair it in place.
+
+    If counts is not NULL, it must have UTF8CHK_ERR_LIMIT elements, and
+    counts[err] is set to the number of errors err replaced.
+
+    Returns UTF8CHK_OK once the whole string has been repaired, or
+    UTF8CHK_ERR_NO_SPACE if the repaired string does not fit. Then, error_at
+    (if not NULL) points to where in the string repairing stopped, and
+    repairing a separate copy can continue from there; the contents of
+    a buffer repaired in place are unspecified. error_len (if not NULL)
+    is set to 0. */
+extern utf8chk_error_t utf8chk_sanitize(const char *string, size_t length,
+            utf8chk_flag_t flags, char *out, size_t out_size,
+            size_t *out_len, size_t *counts,
+            const char **error_at, size_t *error_len);
+#endif
+
+/* An error found by utf8chk_all. */
+typedef struct utf8chk_error_record {
+    /* offset of the error pointer from the start of the string. */
+    size_t offset;
+    /* error length. */
+    size_t length;
+    /* error code. */
+    utf8chk_error_t error;
+} utf8chk_error_record_t;
+
+#ifndef UTF8CHK_STATIC
+/** Finds all errors in a string in one pass. After each error, validation
+    continues after the error length, as if utf8chk were called again from
+    error_at + error_len. The first max_errors errors are stored in errors.
+
+    Returns the number of errors found, which is 0 if the string is valid.
+    If it is greater than max_errors, the rest of the errors were only
+    counted. */
+extern size_t utf8chk_all(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_error_record_t *errors,
+            size_t max_errors);
+#endif
+
+/* An offset into a buffer of strings laid out one after another, as in
+   the 32-bit offsets of an Apache Arrow string array. */
+#if INT_MAX / 10000 > 10000
+typedef int utf8chk_offset_t;
+#else
+typedef long utf8chk_offset_t;
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates count strings with the same flags, as if utf8chk were called
+    on each of them. String i is strings[i], and its length is lengths[i];
+    if lengths is NULL, every string is null-terminated.
+
+    If results is not NULL, the result of string i is stored in results[i].
+    If it is NULL, validation stops at the first invalid string.
+
+    Returns the number of invalid strings, which is 0 if they were all
+    valid (or 1 if results is NULL and any was invalid). */
+extern size_t utf8chk_batch(const char *const *strings,
+            const size_t *lengths, size_t count, utf8chk_flag_t flags,
+            utf8chk_error_t *results);
+
+/** The same as utf8chk_batch, but with the strings stored one after
+    another in data, so that string i runs from data + offsets[i] to
+    data + offsets[i + 1]. offsets must have count + 1 elements. */
+extern size_t utf8chk_batch_offsets(const char *data,
+            const utf8chk_offset_t *offsets, size_t count,
+            utf8chk_flag_t flags, utf8chk_error_t *results);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a column of count strings stored one after another in data,
+    laid out as for utf8chk_batch_offsets, and returns the index of the
+    first invalid string, or count if they are all valid.
+
+    The strings are validated as a whole, in one call, after which only
+    the offsets between them are looked at: each must be at the start of a
+    sequence, and with UTF8CHK_CHECK_SURROGATES, must not be right after
+    a high surrogate. The result is the same as that of calling utf8chk on
+    every string.
+
+    If error is not NULL and a string is invalid, its first error is
+    stored in error, with the offset counted from the start of the
+    string. */
+extern size_t utf8chk_column(const char *data,
+            const utf8chk_offset_t *offsets, size_t count,
+            utf8chk_flag_t flags, utf8chk_error_record_t *error);
+#endif
+
+/* What utf8chk_info found out about the part of a string before its first
+   error, or about all of it if it is valid. */
+typedef struct utf8chk_text_info {
+    /* number of code points. With UTF8CHK_CHECK_SURROGATES, a surrogate
+       pair counts as the one code point it encodes, as in
+       utf8chk_decode32; otherwise every surrogate counts as one. */
+    size_t code_points;
+    /* number of sequences of each length, from 1 byte (ASCII) in
+       sequences[0] to 4 bytes in sequences[3]. */
+    size_t sequences[4];
+    /* number of line feeds (0x0A). */
+    size_t newlines;
+    /* 1-based line of the error pointer, that is, newlines + 1. */
+    size_t line;
+    /* 1-based column of the error pointer within its line,
+       counted in bytes. */
+    size_t column;
+    /* 1-based column of the error pointer within its line,
+       counted in code points. */
+    size_t code_point_column;
+} utf8chk_text_info_t;
+
+#ifndef UTF8CHK_STATIC
+/** Validates a string like utf8chk, and in the same pass stores in info
+    (if not NULL) the number of code points, sequences and lines before the
+    error pointer, as well as the line and column of the error pointer.
+    If the string is valid, the error pointer is at its end, and the counts
+    are for the whole string. */
+extern utf8chk_error_t utf8chk_info(const char *string, size_t length,
+            utf8chk_flag_t flags, const char **error_at, size_t *error_len,
+            utf8chk_text_info_t *info);
+#endif
+
+/* the number of bytes in a block of an index. Must be at least 8, and
+   the same in every compilation unit. */
+#ifndef UTF8CHK_INDEX_BLOCK
+#define UTF8CHK_INDEX_BLOCK 4096
+#endif
+#if UTF8CHK_INDEX_BLOCK < 8
+#error UTF8CHK_INDEX_BLOCK must be at least 8
+#endif
+
+/* the number of entries an index needs for a buffer of length bytes. */
+#define UTF8CHK_INDEX_BLOCKS(length)                                          \
+        (((length) + UTF8CHK_INDEX_BLOCK - 1) / UTF8CHK_INDEX_BLOCK)
+
+/* An index over the blocks of a buffer, for validating any slice of it;
+   see utf8chk_index_build. The fields are private. */
+typedef struct utf8chk_index {
+    /* the buffer and the flags it is validated with. */
+    const char *data;
+    size_t length;
+    utf8chk_flag_t flags;
+    /* one entry for each UTF8CHK_INDEX_BLOCK bytes of the buffer. */
+    unsigned char *blocks;
+    /* the number of entries not marked clean. */
+    size_t dirty;
+} utf8chk_index_t;
+
+#ifndef UTF8CHK_STATIC
+/** Builds an index over a buffer of length bytes, for validating slices
+    of it with the given flags. blocks must have room for
+    UTF8CHK_INDEX_BLOCKS(length) entries, and it and the buffer must stay
+    in place and unchanged while the index is used.
+
+    The buffer is validated once, a block of UTF8CHK_INDEX_BLOCK bytes at
+    a time. Each entry records where the first sequence that can be
+    validated on its own begins in the block (the first that does not
+    continue a sequence or a surrogate pair from the block before it), and
+    whether the bytes from there to the same point in the next block
+    are valid. */
+extern void utf8chk_index_build(utf8chk_index_t *index, const char *data,
+            size_t length, utf8chk_flag_t flags, unsigned char *blocks);
+
+/** Validates the slice from offset begin up to (not including) offset end
+    of the buffer of an index, and returns the same as utf8chk would on
+    it, with error_at pointing into the buffer.
+
+    Only the bytes from begin to the first block boundary, those from the
+    last block boundary to end, and those of blocks not marked clean are
+    validated, so a slice of a valid buffer takes the same time however
+    long it is. */
+extern utf8chk_error_t utf8chk_index_check(const utf8chk_index_t *index,
+            size_t begin, size_t end, const char **error_at,
+            size_t *error_len);
+#endif
+
+#ifndef UTF8CHK_STATIC
+/** Validates a buffer of length bytes after an edit, given that it was
+    valid with the same flags before it. The edit replaced some bytes of
+    the buffer with those from offset edit_begin up to (not including)
+    offset edit_end, which may be equal if bytes were only removed; the
+    bytes before and after them are as they were, if moved.
+
+    Only the edited bytes and the sequences around them are validated:
+    from the start of the sequence before edit_begin (or of the high
+    surrogate before that, with UTF8CHK_CHECK_SURROGATES), up to the
+    start of the first whole sequence after edit_end (after the next
+    sequence as well, if it is a surrogate or follows a high surrogate).
+    Returns the same as utf8chk on the whole buffer. */
+extern utf8chk_error_t utf8chk_revalidate(const char *data, size_t length,
+            utf8chk_flag_t flags, size_t edit_begin, size_t edit_end,
+            const char **error_at, size_t *error_len);
+#endif
+
+#if defined(UTF8CHK_SIMD) && !defined(UTF8CHK_STATIC)
+/** Returns the name of the vector kernel that utf8chk uses on this CPU:
+    "avx2", "sse4.1", "neon" or "none".
+    Only available if UTF8CHK_SIMD is defined. */
+extern const char *utf8chk_simd_name(void);
+#endif
+
+#ifdef UTF8CHK_STATS
+/* a counter that does not wrap around in practice. */
+#if (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)                \
+        || defined(__cplusplus)
+typedef unsigned long long utf8chk_count_t;
+#elif defined(__GNUC__)
+__extension__ typedef unsigned long long utf8chk_count_t;
+#elif defined(_MSC_VER)
+typedef unsigned __int64 utf8chk_count_t;
+#else
+typedef unsigned long utf8chk_count_t;
+#endif
+
+/* Counters kept by each thread if UTF8CHK_STATS is defined. */
+typedef struct utf8chk_stats {
+    /* number of calls to utf8chk and the specialized functions, including
+       those made by the other functions of this library. */
+    utf8chk_count_t calls;
+    /* number of bytes validated, before any error; the sum of the three
+       counters below. */
+    utf8chk_count_t bytes;
+    /* bytes skipped as runs of ASCII between sequences, a word at a time. */
+    utf8chk_count_t ascii_bytes;
+    /* bytes skipped by the vector kernel or the DFA kernel, if compiled in,
+       including any ASCII they skipped. */
+    utf8chk_count_t kernel_bytes;
+    /* bytes decoded one sequence at a time. */
+    utf8chk_count_t decoded_bytes;
+    /* number of calls counted in calls that returned each error code,
+       indexed by the code, so that errors[UTF8CHK_OK] counts the calls
+       that found no error. */
+    utf8chk_count_t errors[UTF8CHK_ERR_LIMIT];
+    /* time stamp counter cycles spent in the calls counted in calls.
+       Only counted if UTF8CHK_STATS_CYCLES is also defined, on x86. */
+    utf8chk_count_t cycles;
+} utf8chk_stats_t;
+
+#ifndef UTF8CHK_STATIC
+/** Stores the counters of the calling thread in stats (if not NULL), and
+    sets them back to zero if reset is nonzero. The counters are kept per
+    thread, so that counting costs no synchronization; to get totals,
+    each thread should add its own counters to them.
+    Only available if UTF8CHK_STATS is defined. */
+extern void utf8chk_stats_snapshot(utf8chk_stats_t *stats, int reset);
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #if defined(UTF8CHK_IMPL) || defined(UTF8CHK_STATIC)
 
+#ifdef UTF8CHK_THREADS
+#include <pthread.h>
+#endif
+
 #define UTF8CHK_SET_ERROR_AT_LEN(p, l) do {                                    \
                     if (error_at) *error_at = (const char *)(p);               \
                     if (error_len) *error_len = (size_t)(l);                   \
@@ -294,215 +876,3631 @@ typedef unsigned long utf8chk_uchar_t;
                     return err##3;                                             \
                 }
 
-/** Validates that the string in a buffer is valid UTF-8.
-    Returns UTF8CHK_OK = 0 if valid, otherwise returns one of the values
-    of enum utf8chk_error (UTF*CHK_ERR_*).
-    
-    If a length is given, it is assumed that it is the length of the
-    string. If string is null-terminated, pass UTF8CHK_CSTRING = (size_t)(-1)
-    as the length.
-    
-    If error_at is not NULL, the error position will be stored
-    in that pointer. Its value depends on the return value;
-    see utf8chk_error.
-    
-    If error_len is not NULL, the error length will be stored
-    in that pointer. Its value depends on the return value;
-    see utf8chk_error.
-    
-    A conforming UTF-8 decoder implementation should use the appropriate flags
-    and replace errors with U+FFFD instead of removing or ignoring error
-    sequences. The error may be replaced by a single U+FFFD, or it may
-    be replaced with as many U+FFFD code points as there were bytes in
-    the error. The former is recommended by modern conventions. */
-#ifdef UTF8CHK_STATIC
-static
+#ifndef UTF8CHK_NO_WORD_SCAN
+/* word type used to scan runs of ASCII several bytes at a time. */
+#ifdef __GNUC__
+typedef size_t __attribute__((__may_alias__)) utf8chk_word_t;
+#else
+typedef size_t utf8chk_word_t;
 #endif
-utf8chk_error_t utf8chk(const char *string, size_t length,
-    utf8chk_flag_t flags, const char **error_at, size_t *error_len) {
-    /* maximum codepoint allowed. */
-    static const utf8chk_uchar_t UNICODE_MAX = UTF8CHK_UCHAR(0x10FFFF);
 
-    /* pointer to read bytes from. */
-    const unsigned char *p = (const unsigned char *)string;
+/* the word scan may read past a null terminator within an aligned word,
+   which is harmless but trips up AddressSanitizer. */
+#if defined(__SANITIZE_ADDRESS__)
+#define UTF8CHK_NO_SANITIZE_ADDRESS __attribute__((__no_sanitize_address__))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define UTF8CHK_NO_SANITIZE_ADDRESS __attribute__((__no_sanitize_address__))
+#endif
+#endif
+#ifndef UTF8CHK_NO_SANITIZE_ADDRESS
+#define UTF8CHK_NO_SANITIZE_ADDRESS
+#endif
 
-    /* whether the string is treated as null-terminated. */
-    int null_terminated = length == UTF8CHK_CSTRING;
+/* 0x0101...01 and 0x8080...80 over the full width of a word. */
+#define UTF8CHK_WORD_ONES ((utf8chk_word_t)-1 / 0xFFU)
+#define UTF8CHK_WORD_HIGHS (UTF8CHK_WORD_ONES * 0x80U)
 
-    /* whether to allow low surrogates. set if and only if the
-       preceding code point was a low surrogate. */
-    int expect_low_surrogate = 0;
+/* Returns the number of bytes at the start of p (at most length) that
+   were found to be ASCII, stopping before any null byte if stop_at_null
+   is set. The bytes are scanned a word at a time, and the scan stops at
+   the first word that is not entirely ASCII, so the returned count may
+   fall short of the full run; the caller handles the rest. */
+UTF8CHK_NO_SANITIZE_ADDRESS
+static size_t utf8chk_ascii_run(const unsigned char *p, size_t length,
+                                int stop_at_null) {
+    const unsigned char *start = p;
 
-    /* cached codepoint from high surrogate. */
-    utf8chk_uchar_t u_cache = 0;
+    /* go byte by byte until p is aligned. aligned loads never cross a
+       page boundary, so reading the rest of the word that contains a
+       null terminator is safe. */
+    while (length && ((size_t)p & (sizeof(utf8chk_word_t) - 1))) {
+        if (*p >= 0x80U || (!*p && stop_at_null))
+            return (size_t)(p - start);
+        ++p, --length;
+    }
 
-    /* expected or read length of sequence. */
-    unsigned n = 0;
+    if (stop_at_null) {
+        while (length >= sizeof(utf8chk_word_t)) {
+            utf8chk_word_t w = *(const utf8chk_word_t *)p;
+            /* w - ONES borrows into the high bit of the first
+               zero byte, if any. */
+            if ((w | (w - UTF8CHK_WORD_ONES)) & UTF8CHK_WORD_HIGHS) break;
+            p += sizeof(utf8chk_word_t), length -= sizeof(utf8chk_word_t);
+        }
+    } else {
+        while (length >= sizeof(utf8chk_word_t)) {
+            utf8chk_word_t w = *(const utf8chk_word_t *)p;
+            if (w & UTF8CHK_WORD_HIGHS) break;
+            p += sizeof(utf8chk_word_t), length -= sizeof(utf8chk_word_t);
+        }
+    }
 
-    /* length of the last sequence. */
-    unsigned n_prev = 0;
+    return (size_t)(p - start);
+}
+#endif
 
-    while (length) {
-        /* byte read. */
-        unsigned char c = *p;
-        /* decoded codepoint. */
-        utf8chk_uchar_t u;
-        /* minimum allowed codepoint (overlong detection). */
-        utf8chk_uchar_t u_min;
-        /* iteration variable used when reading sequences. */
-        unsigned i;
-
-        if (!c) {
-            /* Terminate if string is null-terminated
-               and null terminator found. */
-            if (null_terminated) break;
-            /* If nulls are banned, return an error. */
-            if (flags & UTF8CHK_BAN_NULL_BYTE)
-                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NULL_BYTE, p, 1);
-        }
-
-        if (c < 0x80U) {
-            /* one byte.    0xxxxxxx
-               advance pointer and decrease length. */
-            n = 1;
-            u = c;
-            /* single-byte code points need no further checks
-               (they cannot be surrogates, noncharacters, overlong
-                or truncated) */
-            goto skip_checks;
-        } else if (c < 0xC0U) {
-            /* continuation byte when one was not expected. */
-            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_UNEXPECTED_CONT, p, 1);
-        } else if (c < 0xE0U) {
-            /* two bytes.   110xxxxx */
-            n = 2;
-            u = c & 0x1F;
-            u_min = UTF8CHK_UCHAR(0x0080);
-        } else if (c < 0xF0U) {
-            /* three bytes. 1110xxxx */
-            n = 3;
-            u = c & 0x0F;
-            u_min = UTF8CHK_UCHAR(0x0800);
-        } else if (c < 0xF8U) {
-            /* four bytes.  11110xxx */
-            n = 4;
-            u = c & 0x07;
-            u_min = UTF8CHK_UCHAR(0x10000);
+#if defined(UTF8CHK_SIMD) && (defined(__GNUC__) || defined(_MSC_VER))       \
+        && (defined(__x86_64__) || defined(__i386__)                           \
+            || defined(_M_X64) || defined(_M_IX86))
+#define UTF8CHK_SIMD_X86 1
+#elif defined(UTF8CHK_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define UTF8CHK_SIMD_NEON 1
+#endif
+
+/* Lookup tables for validating UTF-8 by looking at each byte and the three
+   bytes before it, without decoding anything: the method of Keiser and
+   Lemire ("Validating UTF-8 in less than one instruction per byte"), used
+   by the vector kernels below and by utf8chk_valid. They tell apart what
+   can be told with the flags folded into a few mode bits; anything else
+   (such as C0 80 in MUTF-8, surrogates that must be paired or possible
+   noncharacters) is flagged as an error and left to the scalar loop. */
+
+/* mode bits for the kernel, derived from the flags. */
+#define UTF8CHK_SIMD_ALLOW_OVERLONG 1
+#define UTF8CHK_SIMD_ALLOW_SURROGATES 2
+#define UTF8CHK_SIMD_BAN_NULL_BYTE 4
+#define UTF8CHK_SIMD_BAN_NONCHARACTERS 8
+
+static unsigned utf8chk_simd_mode(utf8chk_flag_t flags) {
+    unsigned mode = 0;
+    if (!(flags & (UTF8CHK_BAN_OVERLONG | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)))
+        mode |= UTF8CHK_SIMD_ALLOW_OVERLONG;
+    if (!(flags & (UTF8CHK_BAN_SURROGATES | UTF8CHK_CHECK_SURROGATES)))
+        mode |= UTF8CHK_SIMD_ALLOW_SURROGATES;
+    if (flags & UTF8CHK_BAN_NULL_BYTE)
+        mode |= UTF8CHK_SIMD_BAN_NULL_BYTE;
+    if (flags & UTF8CHK_BAN_NONCHARACTERS)
+        mode |= UTF8CHK_SIMD_BAN_NONCHARACTERS;
+    return mode;
+}
+
+/* error classes, looked up from the high and low nibble of a byte and
+   the high nibble of the byte that follows it. */
+#define UTF8CHK_SIMD_TOO_SHORT 0x01 /* 11______ 0_______ or 11______ */
+#define UTF8CHK_SIMD_TOO_LONG 0x02 /* 0_______ 10______ */
+#define UTF8CHK_SIMD_OVERLONG_3 0x04 /* 11100000 100_____ */
+#define UTF8CHK_SIMD_TOO_LARGE 0x08 /* 11110100 1001____ and above */
+#define UTF8CHK_SIMD_SURROGATE 0x10 /* 11101101 101_____ */
+#define UTF8CHK_SIMD_OVERLONG_2 0x20 /* 1100000_ 10______ */
+#define UTF8CHK_SIMD_TOO_LARGE_1000 0x40 /* 11110101 1000____ and above */
+#define UTF8CHK_SIMD_OVERLONG_4 0x40 /* 11110000 1000____ */
+#define UTF8CHK_SIMD_TWO_CONTS 0x80 /* 10______ 10______ */
+#define UTF8CHK_SIMD_CARRY (UTF8CHK_SIMD_TOO_SHORT | UTF8CHK_SIMD_TOO_LONG     \
+                            | UTF8CHK_SIMD_TWO_CONTS)
+#define UTF8CHK_SIMD_LARGE (UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_TOO_LARGE        \
+                            | UTF8CHK_SIMD_TOO_LARGE_1000)
+
+static const unsigned char utf8chk_simd_byte_1_high[16] = {
+    /* 0_______ ASCII */
+    UTF8CHK_SIMD_TOO_LONG, UTF8CHK_SIMD_TOO_LONG,
+    UTF8CHK_SIMD_TOO_LONG, UTF8CHK_SIMD_TOO_LONG,
+    UTF8CHK_SIMD_TOO_LONG, UTF8CHK_SIMD_TOO_LONG,
+    UTF8CHK_SIMD_TOO_LONG, UTF8CHK_SIMD_TOO_LONG,
+    /* 10______ continuation */
+    UTF8CHK_SIMD_TWO_CONTS, UTF8CHK_SIMD_TWO_CONTS,
+    UTF8CHK_SIMD_TWO_CONTS, UTF8CHK_SIMD_TWO_CONTS,
+    /* 1100____ two bytes */
+    UTF8CHK_SIMD_TOO_SHORT | UTF8CHK_SIMD_OVERLONG_2,
+    /* 1101____ two bytes */
+    UTF8CHK_SIMD_TOO_SHORT,
+    /* 1110____ three bytes */
+    UTF8CHK_SIMD_TOO_SHORT | UTF8CHK_SIMD_OVERLONG_3 | UTF8CHK_SIMD_SURROGATE,
+    /* 1111____ four bytes or invalid */
+    UTF8CHK_SIMD_TOO_SHORT | UTF8CHK_SIMD_TOO_LARGE
+        | UTF8CHK_SIMD_TOO_LARGE_1000 | UTF8CHK_SIMD_OVERLONG_4
+};
+
+/* indexed by mode & (UTF8CHK_SIMD_ALLOW_OVERLONG
+                      | UTF8CHK_SIMD_ALLOW_SURROGATES). */
+static const unsigned char utf8chk_simd_byte_1_low[4][16] = {
+    {
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_OVERLONG_2
+            | UTF8CHK_SIMD_OVERLONG_3 | UTF8CHK_SIMD_OVERLONG_4,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_OVERLONG_2,
+        UTF8CHK_SIMD_CARRY, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_TOO_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE | UTF8CHK_SIMD_SURROGATE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE
+    },
+    { /* overlong allowed, except that overlong four-byte sequences
+         (F0 80 - F0 8F) are still left to the scalar loop: they include
+         the surrogates F0 8D A0 - F0 8D BF, which must be checked. */
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_OVERLONG_4, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_TOO_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE | UTF8CHK_SIMD_SURROGATE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE
+    },
+    { /* surrogates allowed */
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_OVERLONG_2
+            | UTF8CHK_SIMD_OVERLONG_3 | UTF8CHK_SIMD_OVERLONG_4,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_OVERLONG_2,
+        UTF8CHK_SIMD_CARRY, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_TOO_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE
+    },
+    { /* overlong and surrogates allowed */
+        UTF8CHK_SIMD_CARRY, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY, UTF8CHK_SIMD_CARRY,
+        UTF8CHK_SIMD_CARRY | UTF8CHK_SIMD_TOO_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE,
+        UTF8CHK_SIMD_LARGE, UTF8CHK_SIMD_LARGE
+    }
+};
+
+static const unsigned char utf8chk_simd_byte_2_high[16] = {
+    /* ________ 0_______ */
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT,
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT,
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT,
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT,
+    /* ________ 1000____ */
+    UTF8CHK_SIMD_TOO_LONG | UTF8CHK_SIMD_OVERLONG_2 | UTF8CHK_SIMD_TWO_CONTS
+        | UTF8CHK_SIMD_OVERLONG_3 | UTF8CHK_SIMD_TOO_LARGE_1000
+        | UTF8CHK_SIMD_OVERLONG_4,
+    /* ________ 1001____ */
+    UTF8CHK_SIMD_TOO_LONG | UTF8CHK_SIMD_OVERLONG_2 | UTF8CHK_SIMD_TWO_CONTS
+        | UTF8CHK_SIMD_OVERLONG_3 | UTF8CHK_SIMD_TOO_LARGE,
+    /* ________ 101_____ */
+    UTF8CHK_SIMD_TOO_LONG | UTF8CHK_SIMD_OVERLONG_2 | UTF8CHK_SIMD_TWO_CONTS
+        | UTF8CHK_SIMD_SURROGATE | UTF8CHK_SIMD_TOO_LARGE,
+    UTF8CHK_SIMD_TOO_LONG | UTF8CHK_SIMD_OVERLONG_2 | UTF8CHK_SIMD_TWO_CONTS
+        | UTF8CHK_SIMD_SURROGATE | UTF8CHK_SIMD_TOO_LARGE,
+    /* ________ 11______ */
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT,
+    UTF8CHK_SIMD_TOO_SHORT, UTF8CHK_SIMD_TOO_SHORT
+};
+
+/* Given that the kernel found no errors before offset i, returns the offset
+   of a sequence start at or shortly before i for the scalar loop to
+   continue from. */
+static size_t utf8chk_simd_boundary(const unsigned char *p, size_t i) {
+    size_t k;
+    for (k = 1; k <= 3 && k <= i; ++k)
+        if ((p[i - k] & 0xC0U) != 0x80U)
+            return i - k;
+    return i;
+}
+
+#if defined(UTF8CHK_SIMD_X86) || defined(UTF8CHK_SIMD_NEON)
+#define UTF8CHK_SIMD_KERNEL 1
+
+/* The vector kernel validates 64 bytes at a time with the lookup table
+   method of Keiser and Lemire ("Validating UTF-8 in less than one
+   instruction per byte"). It only answers whether a block is valid;
+   as soon as it finds something it does not like, it returns the length
+   of the prefix known to be valid, ending at a sequence boundary, and
+   the scalar loop in utf8chk takes over to find and report the error.
+   Anything the kernel cannot tell apart (such as C0 80 in MUTF-8,
+   surrogates that must be paired or possible noncharacters) is
+   likewise left to the scalar loop. */
+
+/* the scalar loop must consume at least this many bytes after the kernel
+   gives up before the kernel is tried again. */
+#define UTF8CHK_SIMD_RETRY 64
+
+/* a vector ends in an incomplete sequence if any byte is above these. */
+static const unsigned char utf8chk_simd_incomplete[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF
+};
+
+/* Copies the last (less than 64) bytes of the input into a block padded
+   with spaces, so that the kernel never reads past the end of the input. */
+static const unsigned char *utf8chk_simd_tail(unsigned char *block,
+                                const unsigned char *p, size_t length) {
+    size_t i;
+    for (i = 0; i < length; ++i)
+        block[i] = p[i];
+    for (; i < 64; ++i)
+        block[i] = 0x20;
+    return block;
+}
+
+#if defined(UTF8CHK_SIMD_X86)
+#if defined(__GNUC__)
+#define UTF8CHK_TARGET_SSE41 __attribute__((__target__("sse4.1")))
+#define UTF8CHK_TARGET_AVX2 __attribute__((__target__("avx2")))
+#else
+#define UTF8CHK_TARGET_SSE41
+#define UTF8CHK_TARGET_AVX2
+#endif
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* SSE2 can be used without checking for it first. */
+#if defined(UTF8CHK_SIMD_X86) && (defined(__SSE2__) || defined(_M_X64)        \
+        || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define UTF8CHK_WIDEN_SSE2 1
+#endif
+
+/* bytes at offset -1, -2 and -3 from each byte in the vector. */
+#define UTF8CHK_SSE_PREV(in, prev, k) _mm_alignr_epi8(in, prev, 16 - (k))
+#define UTF8CHK_AVX_PREV(in, prev, k) _mm256_alignr_epi8(in,                  \
+                    _mm256_permute2x128_si256(prev, in, 0x21), 16 - (k))
+
+UTF8CHK_TARGET_SSE41
+static __m128i utf8chk_sse_check(__m128i in, __m128i prev,
+                                 __m128i t1, __m128i t2, __m128i t3,
+                                 unsigned mode) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = UTF8CHK_SSE_PREV(in, prev, 1);
+    __m128i prev2 = UTF8CHK_SSE_PREV(in, prev, 2);
+    __m128i prev3 = UTF8CHK_SSE_PREV(in, prev, 3);
+    __m128i special = _mm_and_si128(_mm_and_si128(
+            _mm_shuffle_epi8(t1, _mm_and_si128(_mm_srli_epi16(prev1, 4),
+                                               nibble)),
+            _mm_shuffle_epi8(t2, _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(t3, _mm_and_si128(_mm_srli_epi16(in, 4),
+                                               nibble)));
+    /* a third or fourth byte must be a continuation byte, which the
+       lookup tables above only check for the second byte. */
+    __m128i must23 = _mm_or_si128(
+            _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+            _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    __m128i error = _mm_xor_si128(special, _mm_and_si128(must23,
+                                            _mm_set1_epi8((char)0x80)));
+    if (mode & UTF8CHK_SIMD_BAN_NONCHARACTERS) {
+        /* ?? BF BE, ?? BF BF and EF B7 ??: possible noncharacters,
+           left to the scalar loop to decide. */
+        error = _mm_or_si128(error, _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(prev1, _mm_set1_epi8((char)0xBF)),
+                    _mm_cmpeq_epi8(_mm_max_epu8(in, _mm_set1_epi8((char)0xBE)),
+                                   in)),
+                _mm_and_si128(_mm_cmpeq_epi8(prev2, _mm_set1_epi8((char)0xEF)),
+                    _mm_cmpeq_epi8(prev1, _mm_set1_epi8((char)0xB7)))));
+    }
+    return error;
+}
+
+UTF8CHK_TARGET_SSE41
+static size_t utf8chk_simd_sse41(const unsigned char *p, size_t length,
+                                 unsigned mode) {
+    const __m128i t1 = _mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_1_high);
+    const __m128i t2 = _mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_1_low[mode & 3]);
+    const __m128i t3 = _mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_2_high);
+    const __m128i incomplete = _mm_loadu_si128(
+            (const __m128i *)(utf8chk_simd_incomplete + 16));
+    __m128i prev = _mm_setzero_si128(), prev_incomplete = prev;
+    unsigned char tail[64];
+    size_t i = 0;
+
+    for (;;) {
+        const unsigned char *block = length - i >= 64 ? p + i
+                            : utf8chk_simd_tail(tail, p + i, length - i);
+        __m128i in0 = _mm_loadu_si128((const __m128i *)block);
+        __m128i in1 = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i in2 = _mm_loadu_si128((const __m128i *)(block + 32));
+        __m128i in3 = _mm_loadu_si128((const __m128i *)(block + 48));
+        __m128i error;
+
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(in0, in1),
+                                            _mm_or_si128(in2, in3)))) {
+            /* all ASCII: only a sequence left open by the
+               previous block can be an error. */
+            error = prev_incomplete;
+            prev_incomplete = _mm_setzero_si128();
         } else {
-            /* invalid start byte (overlong or out of range). */
-            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_INVALID_START_BYTE, p, 1);
+            error = _mm_or_si128(
+                _mm_or_si128(utf8chk_sse_check(in0, prev, t1, t2, t3, mode),
+                             utf8chk_sse_check(in1, in0, t1, t2, t3, mode)),
+                _mm_or_si128(utf8chk_sse_check(in2, in1, t1, t2, t3, mode),
+                             utf8chk_sse_check(in3, in2, t1, t2, t3, mode)));
+            prev_incomplete = _mm_subs_epu8(in3, incomplete);
         }
 
-        if (length < n) {
-            /* truncated. return the appropriate error code. */
-            if (expect_low_surrogate) {
-                UTF8CHK_SET_ERROR_AT_LEN(p - n_prev, n_prev);
-                UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_SURROGATE_TRUNC, 
-                                       n - (unsigned)length);
-            }
-            UTF8CHK_SET_ERROR_AT_LEN(p, length);
-            UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_TRUNC, n - (unsigned)length);
-        }
-
-        for (i = 1; i < n; ++i) {
-            c = p[i];
-            /* continuation bytes: high two bits must be 10xxxxxx */
-            if ((c & 0xC0U) != 0x80U) {
-                UTF8CHK_SET_ERROR_AT_LEN(p, i);
-
-                /* expected continuation byte, saw something else. */
-                if (!c && null_terminated) {
-                    /* treat as truncated. */
-                    if (expect_low_surrogate) {
-                        UTF8CHK_SET_ERROR_AT_LEN(p - n_prev, n_prev);
-                        UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_SURROGATE_TRUNC, 
-                                               n - i);
-                    }
-                    UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_TRUNC, n - i);
-                }
-                UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_EXPECTED_CONT, n - i);
-            }
-            u = (u << 6) | (c & 0x3FU);
-        }
-
-        /* check code point range. */
-        if (u > UNICODE_MAX)
-            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_RANGE, p, n);
-
-        /* check for overlong representations. */
-        if ((flags & (UTF8CHK_BAN_OVERLONG
-                    | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)) && u < u_min) {
-            /* possibly allow C0 80. */
-            if ((flags & UTF8CHK_BAN_OVERLONG) || u || length != 2)
-                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_OVERLONG, p, n);
-        }
-
-        /* check for surrogates. */
-        if (UTF8CHK_UCHAR(0xD800) <= u && u <= UTF8CHK_UCHAR(0xDFFF)) {
-            /* U+DC00 - U+DFFF are low surrogates. */
-            int is_low = (int)(u & UTF8CHK_UCHAR(0x400));
-
-            /* if all surrogates are banned, report error. */
-            if (flags & UTF8CHK_BAN_SURROGATES)
-                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE, p, n);
-
-            if (flags & UTF8CHK_CHECK_SURROGATES) {
-                /* check that the surrogate is low/high as specified. */
-                if (is_low && !expect_low_surrogate)
-                    UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_LOW, p, n);
-                else if (!is_low && expect_low_surrogate)
-                    UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_HIGH, p, n);
-
-                /* next surrogate may be low only if this one is high. */
-                expect_low_surrogate = !is_low;
-
-                if (!is_low) {
-                    /* cache the codepoint from the high surrogate.
-                       U+D800 -> U+10000 + (low) 
-                       U+D801 -> U+10400 + (low) 
-                       ...
-                       U+DBFE -> U+10F800 + (low) 
-                       U+DBFF -> U+10FC00 + (low) */
-                    u_cache = UTF8CHK_UCHAR(0x10000) + (
-                            (u & UTF8CHK_UCHAR(0x3FF)) << 10U);
-                    /* no code point 'to output' here - continue. */
-                    goto no_output;
-                }
-                /* set up u for noncharacter check. */
-                u = u_cache | (u & UTF8CHK_UCHAR(0x3FF));
-            }
+        if (mode & UTF8CHK_SIMD_BAN_NULL_BYTE) {
+            const __m128i zero = _mm_setzero_si128();
+            error = _mm_or_si128(error, _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(in0, zero),
+                                 _mm_cmpeq_epi8(in1, zero)),
+                    _mm_or_si128(_mm_cmpeq_epi8(in2, zero),
+                                 _mm_cmpeq_epi8(in3, zero))));
+        }
+
+        if (!_mm_testz_si128(error, error))
+            return utf8chk_simd_boundary(p, i);
+        if (block == tail)
+            return length;
+        prev = in3;
+        i += 64;
+    }
+}
+
+#ifndef UTF8CHK_SIMD_NO_AVX2
+UTF8CHK_TARGET_AVX2
+static __m256i utf8chk_avx2_check(__m256i in, __m256i prev,
+                                  __m256i t1, __m256i t2, __m256i t3,
+                                  unsigned mode) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = UTF8CHK_AVX_PREV(in, prev, 1);
+    __m256i prev2 = UTF8CHK_AVX_PREV(in, prev, 2);
+    __m256i prev3 = UTF8CHK_AVX_PREV(in, prev, 3);
+    __m256i special = _mm256_and_si256(_mm256_and_si256(
+            _mm256_shuffle_epi8(t1, _mm256_and_si256(
+                                _mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(t2, _mm256_and_si256(prev1, nibble))),
+            _mm256_shuffle_epi8(t3, _mm256_and_si256(
+                                _mm256_srli_epi16(in, 4), nibble)));
+    __m256i must23 = _mm256_or_si256(
+            _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+            _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    __m256i error = _mm256_xor_si256(special, _mm256_and_si256(must23,
+                                            _mm256_set1_epi8((char)0x80)));
+    if (mode & UTF8CHK_SIMD_BAN_NONCHARACTERS) {
+        error = _mm256_or_si256(error, _mm256_or_si256(
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xBF)),
+                _mm256_cmpeq_epi8(
+                    _mm256_max_epu8(in, _mm256_set1_epi8((char)0xBE)), in)),
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(prev2, _mm256_set1_epi8((char)0xEF)),
+                _mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xB7)))));
+    }
+    return error;
+}
+
+UTF8CHK_TARGET_AVX2
+static size_t utf8chk_simd_avx2(const unsigned char *p, size_t length,
+                                unsigned mode) {
+    const __m256i t1 = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_1_high));
+    const __m256i t2 = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_1_low[mode & 3]));
+    const __m256i t3 = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+            (const __m128i *)utf8chk_simd_byte_2_high));
+    const __m256i incomplete = _mm256_loadu_si256(
+            (const __m256i *)utf8chk_simd_incomplete);
+    __m256i prev = _mm256_setzero_si256(), prev_incomplete = prev;
+    unsigned char tail[64];
+    size_t i = 0;
+
+    for (;;) {
+        const unsigned char *block = length - i >= 64 ? p + i
+                            : utf8chk_simd_tail(tail, p + i, length - i);
+        __m256i in0 = _mm256_loadu_si256((const __m256i *)block);
+        __m256i in1 = _mm256_loadu_si256((const __m256i *)(block + 32));
+        __m256i error;
+
+        if (!_mm256_movemask_epi8(_mm256_or_si256(in0, in1))) {
+            error = prev_incomplete;
+            prev_incomplete = _mm256_setzero_si256();
         } else {
-            expect_low_surrogate = 0;
+            error = _mm256_or_si256(
+                    utf8chk_avx2_check(in0, prev, t1, t2, t3, mode),
+                    utf8chk_avx2_check(in1, in0, t1, t2, t3, mode));
+            prev_incomplete = _mm256_subs_epu8(in1, incomplete);
+        }
+
+        if (mode & UTF8CHK_SIMD_BAN_NULL_BYTE) {
+            const __m256i zero = _mm256_setzero_si256();
+            error = _mm256_or_si256(error, _mm256_or_si256(
+                    _mm256_cmpeq_epi8(in0, zero),
+                    _mm256_cmpeq_epi8(in1, zero)));
         }
 
-        if (flags & UTF8CHK_BAN_NONCHARACTERS) {
-            /* check for Unicode noncharacters.
-               any nFFFE and nFFFF is a noncharacter. */
-            if ((u & UTF8CHK_UCHAR(0xFFFE)) == UTF8CHK_UCHAR(0xFFFE))
-                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NONCHARACTER, p, n);
+        if (!_mm256_testz_si256(error, error))
+            return utf8chk_simd_boundary(p, i);
+        if (block == tail)
+            return length;
+        prev = in1;
+        i += 64;
+    }
+}
+#endif
+
+/* used when the CPU has neither; the scalar loop does all the work. */
+static size_t utf8chk_simd_none(const unsigned char *p, size_t length,
+                                unsigned mode) {
+    (void)p, (void)length, (void)mode;
+    return 0;
+}
+
+typedef size_t (*utf8chk_simd_fn)(const unsigned char *p, size_t length,
+                                  unsigned mode);
+
+static size_t utf8chk_simd_init(const unsigned char *p, size_t length,
+                                unsigned mode);
+
+/* the kernel in use. picked by utf8chk_simd_init on the first call;
+   every thread picks the same one, so racing on it is harmless. */
+static utf8chk_simd_fn utf8chk_simd_kernel = utf8chk_simd_init;
 
-            /* U+FDD0 - U+FDEF are also noncharacters. */
-            if (UTF8CHK_UCHAR(0xFDD0) <= u && u <= UTF8CHK_UCHAR(0xFDEF))
-                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NONCHARACTER, p, n);
+static size_t utf8chk_simd_init(const unsigned char *p, size_t length,
+                                unsigned mode) {
+    utf8chk_simd_fn kernel = utf8chk_simd_none;
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+#ifndef UTF8CHK_SIMD_NO_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        kernel = utf8chk_simd_avx2;
+    else
+#endif
+    if (__builtin_cpu_supports("sse4.1"))
+        kernel = utf8chk_simd_sse41;
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 1) {
+        __cpuid(info, 1);
+        if (info[2] & (1 << 19))
+            kernel = utf8chk_simd_sse41;
+#ifndef UTF8CHK_SIMD_NO_AVX2
+        /* AVX2 also needs the OS to save the YMM registers. */
+        if ((info[2] & (1 << 27)) && (info[2] & (1 << 28))
+                && (_xgetbv(0) & 6) == 6) {
+            __cpuid(info, 0);
+            if (info[0] >= 7) {
+                __cpuidex(info, 7, 0);
+                if (info[1] & (1 << 5))
+                    kernel = utf8chk_simd_avx2;
+            }
         }
+#endif
+    }
+#endif
+    utf8chk_simd_kernel = kernel;
+    return kernel(p, length, mode);
+}
+#endif /* UTF8CHK_SIMD_X86 */
 
-skip_checks:
-        /* should you wish to decode the string, u is the code point
-           decoded once code reaches this point. */
-        ;
+#if defined(UTF8CHK_SIMD_NEON)
+#include <arm_neon.h>
 
-no_output:
-        /* advance pointer and decrease length. */
-        p += n, length -= n;
-        n_prev = n;
+static uint8x16_t utf8chk_neon_check(uint8x16_t in, uint8x16_t prev,
+                                     uint8x16_t t1, uint8x16_t t2,
+                                     uint8x16_t t3, unsigned mode) {
+    uint8x16_t prev1 = vextq_u8(prev, in, 15);
+    uint8x16_t prev2 = vextq_u8(prev, in, 14);
+    uint8x16_t prev3 = vextq_u8(prev, in, 13);
+    uint8x16_t special = vandq_u8(vandq_u8(
+            vqtbl1q_u8(t1, vshrq_n_u8(prev1, 4)),
+            vqtbl1q_u8(t2, vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+            vqtbl1q_u8(t3, vshrq_n_u8(in, 4)));
+    /* a third or fourth byte must be a continuation byte, which the
+       lookup tables above only check for the second byte. */
+    uint8x16_t must23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                                 vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+    uint8x16_t error = veorq_u8(special,
+                                vandq_u8(must23, vdupq_n_u8(0x80)));
+    if (mode & UTF8CHK_SIMD_BAN_NONCHARACTERS) {
+        /* ?? BF BE, ?? BF BF and EF B7 ??: possible noncharacters,
+           left to the scalar loop to decide. */
+        error = vorrq_u8(error, vorrq_u8(
+                vandq_u8(vceqq_u8(prev1, vdupq_n_u8(0xBF)),
+                         vcgeq_u8(in, vdupq_n_u8(0xBE))),
+                vandq_u8(vceqq_u8(prev2, vdupq_n_u8(0xEF)),
+                         vceqq_u8(prev1, vdupq_n_u8(0xB7)))));
     }
+    return error;
+}
 
-    /* end of string and no low surrogate found.
-       shift back to the high surrogate. */
-    if ((flags & UTF8CHK_CHECK_SURROGATES) && expect_low_surrogate)
-        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_TRUNC, p - n, n);
+static size_t utf8chk_simd_neon(const unsigned char *p, size_t length,
+                                unsigned mode) {
+    const uint8x16_t t1 = vld1q_u8(utf8chk_simd_byte_1_high);
+    const uint8x16_t t2 = vld1q_u8(utf8chk_simd_byte_1_low[mode & 3]);
+    const uint8x16_t t3 = vld1q_u8(utf8chk_simd_byte_2_high);
+    const uint8x16_t incomplete = vld1q_u8(utf8chk_simd_incomplete + 16);
+    uint8x16_t prev = vdupq_n_u8(0), prev_incomplete = prev;
+    unsigned char tail[64];
+    size_t i = 0;
 
-    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+    for (;;) {
+        const unsigned char *block = length - i >= 64 ? p + i
+                            : utf8chk_simd_tail(tail, p + i, length - i);
+        uint8x16_t in0 = vld1q_u8(block);
+        uint8x16_t in1 = vld1q_u8(block + 16);
+        uint8x16_t in2 = vld1q_u8(block + 32);
+        uint8x16_t in3 = vld1q_u8(block + 48);
+        uint8x16_t error;
+
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(in0, in1),
+                               vorrq_u8(in2, in3))) < 0x80U) {
+            /* all ASCII: only a sequence left open by the
+               previous block can be an error. */
+            error = prev_incomplete;
+            prev_incomplete = vdupq_n_u8(0);
+        } else {
+            error = vorrq_u8(
+                vorrq_u8(utf8chk_neon_check(in0, prev, t1, t2, t3, mode),
+                         utf8chk_neon_check(in1, in0, t1, t2, t3, mode)),
+                vorrq_u8(utf8chk_neon_check(in2, in1, t1, t2, t3, mode),
+                         utf8chk_neon_check(in3, in2, t1, t2, t3, mode)));
+            prev_incomplete = vqsubq_u8(in3, incomplete);
+        }
+
+        if (mode & UTF8CHK_SIMD_BAN_NULL_BYTE) {
+            const uint8x16_t zero = vdupq_n_u8(0);
+            error = vorrq_u8(error, vorrq_u8(
+                    vorrq_u8(vceqq_u8(in0, zero), vceqq_u8(in1, zero)),
+                    vorrq_u8(vceqq_u8(in2, zero), vceqq_u8(in3, zero))));
+        }
+
+        if (vmaxvq_u8(error))
+            return utf8chk_simd_boundary(p, i);
+        if (block == tail)
+            return length;
+        prev = in3;
+        i += 64;
+    }
+}
+
+/* NEON is always there on AArch64, so there is nothing to pick. */
+#define utf8chk_simd_kernel utf8chk_simd_neon
+#endif /* UTF8CHK_SIMD_NEON */
+
+#ifndef UTF8CHK_CSTRING_BLOCK
+/* how many bytes of a null-terminated string are searched for the
+   terminator at a time, before the vector kernel validates them.
+   Must be at least 8. */
+#define UTF8CHK_CSTRING_BLOCK 16384
+#endif
+#if UTF8CHK_CSTRING_BLOCK < 8
+#error UTF8CHK_CSTRING_BLOCK must be at least 8
+#endif
+
+/* Returns the number of bytes before the first null byte of p, or max if
+   there is none among the first max bytes. The string is read 16 bytes at
+   a time with aligned loads, which never cross a page boundary, so the
+   bytes around the string in the vectors that hold its first byte and
+   its terminator are read too, but never those of a page that the string
+   does not reach. */
+#ifndef UTF8CHK_NO_WORD_SCAN
+UTF8CHK_NO_SANITIZE_ADDRESS
+#endif
+static size_t utf8chk_simd_strnlen(const unsigned char *p, size_t max) {
+    size_t i = 0;
+#if !defined(UTF8CHK_NO_WORD_SCAN)                                            \
+        && (defined(UTF8CHK_WIDEN_SSE2) || defined(UTF8CHK_SIMD_NEON))
+    /* the bytes of the first vector that come before p. */
+    size_t skew = (size_t)p & 15U, at = 0;
+#if defined(UTF8CHK_WIDEN_SSE2)
+    /* one bit for each byte of the vector that is zero. */
+#define UTF8CHK_ZERO_BITS 1
+#define UTF8CHK_ZERO_MASK(q) (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(     \
+            _mm_load_si128((const __m128i *)(q)), _mm_setzero_si128()))
+    /* whether any of the 64 bytes from q is zero. */
+#define UTF8CHK_ZERO_ANY64(q) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(   \
+            _mm_min_epu8(_mm_load_si128((const __m128i *)(q)),                 \
+                         _mm_load_si128((const __m128i *)(q) + 1)),            \
+            _mm_min_epu8(_mm_load_si128((const __m128i *)(q) + 2),             \
+                         _mm_load_si128((const __m128i *)(q) + 3))),           \
+            _mm_setzero_si128()))
+    unsigned mask;
+#else
+    /* four bits for each byte of the vector that is zero. */
+#define UTF8CHK_ZERO_BITS 4
+#define UTF8CHK_ZERO_MASK(q) vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(    \
+            vreinterpretq_u16_u8(vceqq_u8(vld1q_u8(q), vdupq_n_u8(0))), 4)), 0)
+#define UTF8CHK_ZERO_ANY64(q) !vminvq_u8(vminq_u8(                             \
+            vminq_u8(vld1q_u8(q), vld1q_u8((q) + 16)),                         \
+            vminq_u8(vld1q_u8((q) + 32), vld1q_u8((q) + 48))))
+    uint64_t mask;
+#endif
+
+    /* 16 bytes at a time up to a 64-byte boundary, then 64 bytes at
+       a time up to the block that has the terminator, in which it is
+       looked for 16 bytes at a time again. */
+    mask = UTF8CHK_ZERO_MASK(p - skew) >> (skew * UTF8CHK_ZERO_BITS);
+    for (i = 16 - skew; !mask && i < max; i += 16) {
+        if (!((size_t)(p + i) & 63U))
+            while (i < max && !UTF8CHK_ZERO_ANY64(p + i))
+                i += 64;
+        if (i < max && (mask = UTF8CHK_ZERO_MASK(p + i)) != 0)
+            at = i;
+    }
+    if (!mask)
+        return max;
+    while (!(mask & ((1U << UTF8CHK_ZERO_BITS) - 1)))
+        mask >>= UTF8CHK_ZERO_BITS, ++at;
+#undef UTF8CHK_ZERO_BITS
+#undef UTF8CHK_ZERO_MASK
+#undef UTF8CHK_ZERO_ANY64
+    return at < max ? at : max;
+#else
+    while (i < max && p[i])
+        ++i;
+    return i;
+#endif
+}
+#endif /* UTF8CHK_SIMD_KERNEL */
+
+#if defined(UTF8CHK_DFA) && !defined(UTF8CHK_SIMD_KERNEL)
+#define UTF8CHK_DFA_KERNEL 1
+
+/* The DFA kernel validates a byte at a time with a table-driven state
+   machine in the style of Hoehrmann ("Flexible and Economical UTF-8
+   Decoder"), without the cascade of branches in the scalar loop. The
+   transition table is generated for the flags at hand, so that it can
+   tell apart overlong representations, surrogates (including the pairing
+   checked by UTF8CHK_CHECK_SURROGATES) and noncharacters. Like the vector
+   kernel, it only answers whether the string is valid; when it rejects
+   a byte, it returns the length of the prefix known to be valid, and the
+   scalar loop takes over to find and report the error. A few rare valid
+   sequences (overlong four-byte sequences when surrogates or noncharacters
+   must be checked, and surrogate pairs that might encode a noncharacter)
+   are likewise left to the scalar loop. */
+
+/* byte classes. */
+enum utf8chk_dfa_class {
+    UTF8CHK_DFA_NUL,        /* 00 */
+    UTF8CHK_DFA_ASCII,      /* 01 - 7F */
+    UTF8CHK_DFA_80,         /* 80 */
+    UTF8CHK_DFA_81,         /* 81 - 8E */
+    UTF8CHK_DFA_8F,         /* 8F */
+    UTF8CHK_DFA_90,         /* 90 - 9E */
+    UTF8CHK_DFA_9F,         /* 9F */
+    UTF8CHK_DFA_A0,         /* A0 - AE */
+    UTF8CHK_DFA_AF,         /* AF */
+    UTF8CHK_DFA_B0,         /* B0 - B6 */
+    UTF8CHK_DFA_B7,         /* B7 */
+    UTF8CHK_DFA_B8,         /* B8 - BD */
+    UTF8CHK_DFA_BE,         /* BE */
+    UTF8CHK_DFA_BF,         /* BF */
+    UTF8CHK_DFA_C0,         /* C0 */
+    UTF8CHK_DFA_C1,         /* C1 */
+    UTF8CHK_DFA_C2,         /* C2 - DF */
+    UTF8CHK_DFA_E0,         /* E0 */
+    UTF8CHK_DFA_E1,         /* E1 - EC, EE */
+    UTF8CHK_DFA_ED,         /* ED */
+    UTF8CHK_DFA_EF,         /* EF */
+    UTF8CHK_DFA_F0,         /* F0 */
+    UTF8CHK_DFA_F1,         /* F1 - F3 */
+    UTF8CHK_DFA_F4,         /* F4 */
+    UTF8CHK_DFA_F5          /* F5 - FF */
+};
+
+/* a plain number rather than an enumerator, so that it can be multiplied
+   by a state without mixing enumerations, which C++20 deprecates. */
+#define UTF8CHK_DFA_CLASSES ((unsigned)UTF8CHK_DFA_F5 + 1)
+
+/* states. */
+enum utf8chk_dfa_state {
+    UTF8CHK_DFA_REJECT,     /* error (or something left to the scalar loop) */
+    UTF8CHK_DFA_ACCEPT,     /* at a sequence boundary */
+    UTF8CHK_DFA_HIGH,       /* after a high surrogate, at a boundary */
+    UTF8CHK_DFA_CONT1,      /* one more continuation byte expected */
+    UTF8CHK_DFA_CONT2,      /* two more */
+    UTF8CHK_DFA_AFTER_C0,   /* C0, only C0 80 allowed */
+    UTF8CHK_DFA_AFTER_E0,   /* E0 */
+    UTF8CHK_DFA_AFTER_ED,   /* ED */
+    UTF8CHK_DFA_AFTER_HIGH_ED, /* ED after a high surrogate */
+    UTF8CHK_DFA_IN_HIGH,    /* ED A0 - ED AF, the rest of a high surrogate */
+    UTF8CHK_DFA_AFTER_EF,   /* EF */
+    UTF8CHK_DFA_AFTER_EFB7, /* EF B7, FDD0 - FDEF are noncharacters */
+    UTF8CHK_DFA_AFTER_F0,   /* F0 */
+    UTF8CHK_DFA_AFTER_F1,   /* F1 - F3 */
+    UTF8CHK_DFA_AFTER_F4,   /* F4 */
+    UTF8CHK_DFA_PLANE_END,  /* F_ _F, nFFFE and nFFFF are noncharacters */
+    UTF8CHK_DFA_LAST_BF,    /* ___ BF, so the last byte may not be BE or BF */
+    UTF8CHK_DFA_STATES
+};
+
+static const unsigned char utf8chk_dfa_classes[256] = {
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8,
+    9, 9, 9, 9, 9, 9, 9, 10, 11, 11, 11, 11, 11, 11, 12, 13,
+    14, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 19, 18, 20,
+    21, 22, 22, 22, 23, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24
+};
+
+/* the transition table. states are stored premultiplied by
+   UTF8CHK_DFA_CLASSES, so that the next state is simply
+   next[state + class]. */
+typedef struct utf8chk_dfa {
+    unsigned short next[UTF8CHK_DFA_STATES * UTF8CHK_DFA_CLASSES];
+} utf8chk_dfa_t;
+
+#ifndef UTF8CHK_DFA_MIN
+/* the DFA kernel is only set up for strings at least this long. */
+#define UTF8CHK_DFA_MIN 256
+#endif
+
+/* the scalar loop must consume at least this many bytes after the kernel
+   gives up before the kernel is tried again. */
+#define UTF8CHK_DFA_RETRY 64
+
+/* sets the transitions from state on the continuation bytes
+   from class lo to class hi to go to state to. */
+static void utf8chk_dfa_conts(utf8chk_dfa_t *dfa, unsigned state,
+                              unsigned lo, unsigned hi, unsigned to) {
+    unsigned k;
+    for (k = lo; k <= hi; ++k)
+        dfa->next[state * UTF8CHK_DFA_CLASSES + k] =
+                (unsigned short)(to * UTF8CHK_DFA_CLASSES);
+}
+
+/* Generates the transition table for the given flags. */
+static void utf8chk_dfa_build(utf8chk_dfa_t *dfa, utf8chk_flag_t flags,
+                              int null_terminated) {
+    int ban_overlong = (flags & (UTF8CHK_BAN_OVERLONG
+                               | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)) != 0;
+    int ban_nonchar = (flags & UTF8CHK_BAN_NONCHARACTERS) != 0;
+    int ban_surrogates = (flags & UTF8CHK_BAN_SURROGATES) != 0;
+    int check_surrogates = !ban_surrogates
+                        && (flags & UTF8CHK_CHECK_SURROGATES);
+    /* state after a second byte _F of a four-byte sequence. */
+    unsigned plane_end = ban_nonchar ? UTF8CHK_DFA_PLANE_END
+                                     : UTF8CHK_DFA_CONT2;
+    unsigned s, k;
+
+    for (k = 0; k < UTF8CHK_DFA_STATES * UTF8CHK_DFA_CLASSES; ++k)
+        dfa->next[k] = UTF8CHK_DFA_REJECT;
+
+    /* sequence starts, after a boundary or a high surrogate. */
+    for (s = UTF8CHK_DFA_ACCEPT; s <= UTF8CHK_DFA_HIGH; ++s) {
+        unsigned short *next = &dfa->next[s * UTF8CHK_DFA_CLASSES];
+        if (s == UTF8CHK_DFA_HIGH && !check_surrogates) break;
+
+        if (!null_terminated && !(flags & UTF8CHK_BAN_NULL_BYTE))
+            next[UTF8CHK_DFA_NUL] = UTF8CHK_DFA_ACCEPT * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_ASCII] = UTF8CHK_DFA_ACCEPT * UTF8CHK_DFA_CLASSES;
+        if (!(flags & UTF8CHK_BAN_OVERLONG)) {
+            next[UTF8CHK_DFA_C0] = (unsigned short)(UTF8CHK_DFA_CLASSES
+                    * (ban_overlong ? UTF8CHK_DFA_AFTER_C0
+                                    : UTF8CHK_DFA_CONT1));
+        }
+        if (!ban_overlong)
+            next[UTF8CHK_DFA_C1] = UTF8CHK_DFA_CONT1 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_C2] = UTF8CHK_DFA_CONT1 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_E0] = UTF8CHK_DFA_AFTER_E0 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_E1] = UTF8CHK_DFA_CONT2 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_ED] = (unsigned short)(UTF8CHK_DFA_CLASSES
+                * (s == UTF8CHK_DFA_HIGH ? UTF8CHK_DFA_AFTER_HIGH_ED
+                                         : UTF8CHK_DFA_AFTER_ED));
+        next[UTF8CHK_DFA_EF] = (unsigned short)(UTF8CHK_DFA_CLASSES
+                * (ban_nonchar ? UTF8CHK_DFA_AFTER_EF : UTF8CHK_DFA_CONT2));
+        next[UTF8CHK_DFA_F0] = UTF8CHK_DFA_AFTER_F0 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_F1] = UTF8CHK_DFA_AFTER_F1 * UTF8CHK_DFA_CLASSES;
+        next[UTF8CHK_DFA_F4] = UTF8CHK_DFA_AFTER_F4 * UTF8CHK_DFA_CLASSES;
+    }
+
+    /* continuation bytes. */
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_CONT1, UTF8CHK_DFA_80, UTF8CHK_DFA_BF,
+                      UTF8CHK_DFA_ACCEPT);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_CONT2, UTF8CHK_DFA_80, UTF8CHK_DFA_BF,
+                      UTF8CHK_DFA_CONT1);
+
+    /* C0 80 with UTF8CHK_BAN_OVERLONG_EXCEPT_NULL. */
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_C0, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_80, UTF8CHK_DFA_ACCEPT);
+
+    /* E0 80 - E0 9F are overlong. */
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_E0,
+                      ban_overlong ? UTF8CHK_DFA_A0 : UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT1);
+
+    /* ED A0 - ED BF are surrogates. */
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_ED, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_9F, UTF8CHK_DFA_CONT1);
+    if (check_surrogates) {
+        /* a high surrogate must not be followed by another one,
+           and a low surrogate must follow a high one. */
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_ED, UTF8CHK_DFA_A0,
+                          UTF8CHK_DFA_AF, UTF8CHK_DFA_IN_HIGH);
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_HIGH_ED, UTF8CHK_DFA_80,
+                          UTF8CHK_DFA_9F, UTF8CHK_DFA_CONT1);
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_HIGH_ED, UTF8CHK_DFA_B0,
+                          UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT1);
+        /* a pair with a high surrogate ending in BF might encode
+           a noncharacter. */
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_IN_HIGH, UTF8CHK_DFA_80,
+                          ban_nonchar ? UTF8CHK_DFA_BE : UTF8CHK_DFA_BF,
+                          UTF8CHK_DFA_HIGH);
+    } else if (!ban_surrogates) {
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_ED, UTF8CHK_DFA_A0,
+                          UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT1);
+    }
+
+    /* EF B7 90 - EF B7 AF and EF BF BE - EF BF BF are noncharacters. */
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_EF, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT1);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_EF, UTF8CHK_DFA_B7,
+                      UTF8CHK_DFA_B7, UTF8CHK_DFA_AFTER_EFB7);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_EF, UTF8CHK_DFA_BF,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_LAST_BF);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_EFB7, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_8F, UTF8CHK_DFA_ACCEPT);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_EFB7, UTF8CHK_DFA_B0,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_ACCEPT);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_LAST_BF, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_B8, UTF8CHK_DFA_ACCEPT);
+
+    /* F0 80 - F0 8F are overlong, which are left to the scalar loop
+       if they might encode a surrogate or a noncharacter. F4 90 and
+       above are beyond U+10FFFF. */
+    if (!ban_overlong && !ban_nonchar && (flags & (UTF8CHK_BAN_SURROGATES
+                                              | UTF8CHK_CHECK_SURROGATES)) == 0)
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F0, UTF8CHK_DFA_80,
+                          UTF8CHK_DFA_8F, UTF8CHK_DFA_CONT2);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F0, UTF8CHK_DFA_90,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT2);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F1, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_CONT2);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F4, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_8F, UTF8CHK_DFA_CONT2);
+    /* second bytes _F end a plane. */
+    for (k = 0; k < 4; ++k) {
+        static const unsigned char ends[4] = {
+            UTF8CHK_DFA_8F, UTF8CHK_DFA_9F, UTF8CHK_DFA_AF, UTF8CHK_DFA_BF
+        };
+        unsigned c = ends[k];
+        /* F0 8F is overlong, and only ever let through if noncharacters
+           are allowed. */
+        if (k) utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F0, c, c, plane_end);
+        utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F1, c, c, plane_end);
+    }
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_AFTER_F4, UTF8CHK_DFA_8F,
+                      UTF8CHK_DFA_8F, plane_end);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_PLANE_END, UTF8CHK_DFA_80,
+                      UTF8CHK_DFA_BE, UTF8CHK_DFA_CONT1);
+    utf8chk_dfa_conts(dfa, UTF8CHK_DFA_PLANE_END, UTF8CHK_DFA_BF,
+                      UTF8CHK_DFA_BF, UTF8CHK_DFA_LAST_BF);
+}
+
+/* Returns the length of the prefix of p (at most length bytes) that the
+   DFA accepts, ending at a sequence boundary that is not after a high
+   surrogate. Stops at the first byte rejected, which for a null-terminated
+   string includes the null terminator. stop_at_null is passed on to the
+   word scan, which skips runs of ASCII between sequences. */
+#ifndef UTF8CHK_NO_WORD_SCAN
+UTF8CHK_NO_SANITIZE_ADDRESS
+#endif
+static size_t utf8chk_dfa_kernel(const utf8chk_dfa_t *dfa,
+                                 const unsigned char *p, size_t length,
+                                 int stop_at_null) {
+    size_t i, valid = 0;
+    unsigned state = UTF8CHK_DFA_ACCEPT * UTF8CHK_DFA_CLASSES;
+#ifdef UTF8CHK_NO_WORD_SCAN
+    (void)stop_at_null;
+#endif
+
+    for (i = 0; i < length; ++i) {
+#ifndef UTF8CHK_NO_WORD_SCAN
+        /* at each aligned word, hand over to the word scan if the whole
+           word is ASCII. checking for short runs byte by byte would cost
+           more than it saves on text that mixes in other scripts. */
+        if (!((size_t)(p + i) & (sizeof(utf8chk_word_t) - 1))
+                && state == UTF8CHK_DFA_ACCEPT * UTF8CHK_DFA_CLASSES
+                && length - i >= sizeof(utf8chk_word_t)
+                && !(*(const utf8chk_word_t *)(p + i) & UTF8CHK_WORD_HIGHS)) {
+            i += utf8chk_ascii_run(p + i, length - i, stop_at_null);
+            valid = i;
+            if (i == length) break;
+        }
+#endif
+        state = dfa->next[state + utf8chk_dfa_classes[p[i]]];
+        if (state == UTF8CHK_DFA_REJECT) break;
+        /* written as a select, since the branch would be unpredictable
+           on text that mixes sequence lengths. */
+        valid = state == UTF8CHK_DFA_ACCEPT * UTF8CHK_DFA_CLASSES
+              ? i + 1 : valid;
+    }
+    return valid;
+}
+#endif /* UTF8CHK_DFA_KERNEL */
+
+#ifdef UTF8CHK_SIMD
+/** Returns the name of the vector kernel that utf8chk uses on this CPU:
+    "avx2", "sse4.1", "neon" or "none". */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+const char *utf8chk_simd_name(void) {
+#if defined(UTF8CHK_SIMD_X86)
+    static const unsigned char dummy = 0;
+    /* make sure a kernel has been picked. */
+    if (utf8chk_simd_kernel == utf8chk_simd_init)
+        utf8chk_simd_init(&dummy, 0, 0);
+#ifndef UTF8CHK_SIMD_NO_AVX2
+    if (utf8chk_simd_kernel == utf8chk_simd_avx2)
+        return "avx2";
+#endif
+    if (utf8chk_simd_kernel == utf8chk_simd_sse41)
+        return "sse4.1";
+    return "none";
+#elif defined(UTF8CHK_SIMD_NEON)
+    return "neon";
+#else
+    return "none";
+#endif
+}
+#endif
+
+#if defined(__GNUC__)
+#define UTF8CHK_INLINE __inline__ __attribute__((__always_inline__))
+#elif defined(_MSC_VER)
+#define UTF8CHK_INLINE __forceinline
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define UTF8CHK_INLINE inline
+#else
+#define UTF8CHK_INLINE
+#endif
+
+#ifdef UTF8CHK_STATS
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define UTF8CHK_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L              \
+        && !defined(__STDC_NO_THREADS__)
+#define UTF8CHK_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define UTF8CHK_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define UTF8CHK_THREAD_LOCAL __declspec(thread)
+#else
+/* no thread-local storage; the counters are shared, and only
+   correct if one thread at a time validates. */
+#define UTF8CHK_THREAD_LOCAL
+#endif
+
+/* the counters of this thread. */
+static UTF8CHK_THREAD_LOCAL utf8chk_stats_t utf8chk_stats_local;
+
+#if defined(UTF8CHK_STATS_CYCLES) && defined(__GNUC__)                        \
+        && (defined(__x86_64__) || defined(__i386__))
+/* Returns the time stamp counter. */
+static UTF8CHK_INLINE utf8chk_count_t utf8chk_stats_clock(void) {
+    unsigned lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (utf8chk_count_t)hi << 32 | lo;
+}
+#elif defined(UTF8CHK_STATS_CYCLES) && defined(_MSC_VER)                      \
+        && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define utf8chk_stats_clock() ((utf8chk_count_t)__rdtsc())
+#else
+#define utf8chk_stats_clock() ((utf8chk_count_t)0)
+#endif
+
+/* adds to a count kept in a local variable while the string is scanned,
+   to be recorded once at the end. */
+#define UTF8CHK_STATS_ADD(count, n) ((count) += (n))
+
+/* Records the bytes validated by a pass over a string, by how they
+   were validated. */
+static void utf8chk_stats_bytes(size_t ascii, size_t kernel, size_t decoded) {
+    utf8chk_stats_local.bytes += ascii + kernel + decoded;
+    utf8chk_stats_local.ascii_bytes += ascii;
+    utf8chk_stats_local.kernel_bytes += kernel;
+    utf8chk_stats_local.decoded_bytes += decoded;
+}
+
+/* Records a call to utf8chk that started at the given clock and returned
+   err. */
+static void utf8chk_stats_call(utf8chk_error_t err, utf8chk_count_t started) {
+    ++utf8chk_stats_local.calls;
+    if ((unsigned)err < UTF8CHK_ERR_LIMIT)
+        ++utf8chk_stats_local.errors[err];
+    utf8chk_stats_local.cycles += utf8chk_stats_clock() - started;
+}
+
+/** Stores and resets the counters of the calling thread;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+void utf8chk_stats_snapshot(utf8chk_stats_t *stats, int reset) {
+    static utf8chk_stats_t zero; /* never written, so all zeros. */
+    if (stats) *stats = utf8chk_stats_local;
+    if (reset) utf8chk_stats_local = zero;
+}
+#else
+#define UTF8CHK_STATS_ADD(count, n) ((void)0)
+#endif
+
+/* the 'code point' decoded from a high surrogate that has been cached
+   to be combined with the low surrogate that follows. */
+#define UTF8CHK_NO_OUTPUT ((utf8chk_uchar_t)-1)
+
+#define UTF8CHK_STATE_INIT(state) ((state).u_cache = 0, (state).n_prev = 0,  \
+                                   (state).expect_low_surrogate = 0)
+
+/* Decodes and validates the single sequence at p, with length bytes left
+   in the string. The null terminator of a null-terminated string is never
+   passed in; it is up to the caller to stop there.
+
+   On success, returns UTF8CHK_OK, stores the length of the sequence
+   in *n_out and the decoded code point (or UTF8CHK_NO_OUTPUT) in *u_out,
+   and updates the state. Otherwise returns and reports the error just like
+   utf8chk does, leaving the state as it was. */
+static UTF8CHK_INLINE utf8chk_error_t utf8chk_decode(utf8chk_state_t *state,
+        const unsigned char *p, size_t length, int null_terminated,
+        utf8chk_flag_t flags, unsigned *n_out, utf8chk_uchar_t *u_out,
+        const char **error_at, size_t *error_len) {
+    /* maximum codepoint allowed. */
+    static const utf8chk_uchar_t UNICODE_MAX = UTF8CHK_UCHAR(0x10FFFF);
+
+    /* byte read. */
+    unsigned char c = *p;
+
+    /* whether to allow low surrogates after this sequence. */
+    int expect_low_surrogate = state->expect_low_surrogate;
+
+    /* decoded codepoint. */
+    utf8chk_uchar_t u;
+    /* minimum allowed codepoint (overlong detection). */
+    utf8chk_uchar_t u_min;
+    /* expected or read length of sequence. */
+    unsigned n;
+    /* iteration variable used when reading sequences. */
+    unsigned i;
+
+    if (c < 0x80U) {
+        /* If nulls are banned, return an error. */
+        if (!c && !null_terminated && (flags & UTF8CHK_BAN_NULL_BYTE))
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NULL_BYTE, p, 1);
+        /* one byte.    0xxxxxxx
+           single-byte code points need no further checks
+           (they cannot be surrogates, noncharacters, overlong
+            or truncated), but being no low surrogate, they leave
+           any preceding high surrogate unpaired. */
+        state->expect_low_surrogate = 0;
+        state->n_prev = *n_out = 1;
+        *u_out = c;
+        return UTF8CHK_OK;
+    } else if (c < 0xC0U) {
+        /* continuation byte when one was not expected. */
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_UNEXPECTED_CONT, p, 1);
+    } else if (c < 0xE0U) {
+        /* two bytes.   110xxxxx */
+        n = 2;
+        u = c & 0x1F;
+        u_min = UTF8CHK_UCHAR(0x0080);
+    } else if (c < 0xF0U) {
+        /* three bytes. 1110xxxx */
+        n = 3;
+        u = c & 0x0F;
+        u_min = UTF8CHK_UCHAR(0x0800);
+    } else if (c < 0xF8U) {
+        /* four bytes.  11110xxx */
+        n = 4;
+        u = c & 0x07;
+        u_min = UTF8CHK_UCHAR(0x10000);
+    } else {
+        /* invalid start byte (overlong or out of range). */
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_INVALID_START_BYTE, p, 1);
+    }
+
+    if (length < n) {
+        /* truncated. return the appropriate error code. */
+        if (expect_low_surrogate) {
+            UTF8CHK_SET_ERROR_AT_LEN(p - state->n_prev, state->n_prev);
+            UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_SURROGATE_TRUNC, 
+                                   n - (unsigned)length);
+        }
+        UTF8CHK_SET_ERROR_AT_LEN(p, length);
+        UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_TRUNC, n - (unsigned)length);
+    }
+
+    for (i = 1; i < n; ++i) {
+        c = p[i];
+        /* continuation bytes: high two bits must be 10xxxxxx */
+        if ((c & 0xC0U) != 0x80U) {
+            UTF8CHK_SET_ERROR_AT_LEN(p, i);
+
+            /* expected continuation byte, saw something else. */
+            if (!c && null_terminated) {
+                /* treat as truncated. */
+                if (expect_low_surrogate) {
+                    UTF8CHK_SET_ERROR_AT_LEN(p - state->n_prev,
+                                             state->n_prev);
+                    UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_SURROGATE_TRUNC, 
+                                           n - i);
+                }
+                UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_TRUNC, n - i);
+            }
+            UTF8CHK_RETURN_ERROR_N(UTF8CHK_ERR_EXPECTED_CONT, n - i);
+        }
+        u = (u << 6) | (c & 0x3FU);
+    }
+
+    /* check code point range. */
+    if (u > UNICODE_MAX)
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_RANGE, p, n);
+
+    /* check for overlong representations. */
+    if ((flags & (UTF8CHK_BAN_OVERLONG
+                | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)) && u < u_min) {
+        /* possibly allow C0 80. */
+        if ((flags & UTF8CHK_BAN_OVERLONG) || u || n != 2)
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_OVERLONG, p, n);
+    }
+
+    /* check for surrogates. */
+    if (UTF8CHK_UCHAR(0xD800) <= u && u <= UTF8CHK_UCHAR(0xDFFF)) {
+        /* U+DC00 - U+DFFF are low surrogates. */
+        int is_low = (int)(u & UTF8CHK_UCHAR(0x400));
+
+        /* if all surrogates are banned, report error. */
+        if (flags & UTF8CHK_BAN_SURROGATES)
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE, p, n);
+
+        if (flags & UTF8CHK_CHECK_SURROGATES) {
+            /* check that the surrogate is low/high as specified. */
+            if (is_low && !expect_low_surrogate)
+                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_LOW, p, n);
+            else if (!is_low && expect_low_surrogate)
+                UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_HIGH, p, n);
+
+            /* next surrogate may be low only if this one is high. */
+            expect_low_surrogate = !is_low;
+
+            if (!is_low) {
+                /* cache the codepoint from the high surrogate.
+                   U+D800 -> U+10000 + (low) 
+                   U+D801 -> U+10400 + (low) 
+                   ...
+                   U+DBFE -> U+10F800 + (low) 
+                   U+DBFF -> U+10FC00 + (low) */
+                state->u_cache = UTF8CHK_UCHAR(0x10000) + (
+                        (u & UTF8CHK_UCHAR(0x3FF)) << 10U);
+                /* no code point 'to output' here - continue. */
+                u = UTF8CHK_NO_OUTPUT;
+                goto no_output;
+            }
+            /* set up u for noncharacter check. */
+            u = state->u_cache | (u & UTF8CHK_UCHAR(0x3FF));
+        }
+    } else {
+        expect_low_surrogate = 0;
+    }
+
+    if (flags & UTF8CHK_BAN_NONCHARACTERS) {
+        /* check for Unicode noncharacters.
+           any nFFFE and nFFFF is a noncharacter. */
+        if ((u & UTF8CHK_UCHAR(0xFFFE)) == UTF8CHK_UCHAR(0xFFFE))
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NONCHARACTER, p, n);
+
+        /* U+FDD0 - U+FDEF are also noncharacters. */
+        if (UTF8CHK_UCHAR(0xFDD0) <= u && u <= UTF8CHK_UCHAR(0xFDEF))
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NONCHARACTER, p, n);
+    }
+
+no_output:
+    state->expect_low_surrogate = expect_low_surrogate;
+    state->n_prev = *n_out = n;
+    *u_out = u;
+    return UTF8CHK_OK;
+}
+
+/* Validates the sequences starting from *pp, up to length bytes or a null
+   terminator if null_terminated is set, carrying the state from one
+   sequence to the next. Stops at the end of the string or at the first
+   error, leaving *pp at the end of the string or the start of the
+   sequence that has the error. An unpaired high surrogate at the end
+   of the string is left for the caller to check. */
+static UTF8CHK_INLINE utf8chk_error_t utf8chk_run(utf8chk_state_t *state,
+        const unsigned char **pp, size_t length, int null_terminated,
+        utf8chk_flag_t flags, const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = *pp;
+
+    /* error found, if any. */
+    utf8chk_error_t err = UTF8CHK_OK;
+
+#ifdef UTF8CHK_STATS
+    /* bytes skipped by the kernels and by the word scan. */
+    size_t kernel_bytes = 0, ascii_bytes = 0;
+#endif
+
+#ifdef UTF8CHK_SIMD_KERNEL
+    /* what the vector kernel may check. */
+    unsigned simd_mode = utf8chk_simd_mode(flags);
+
+    /* the kernel is run whenever length drops to this or below. */
+    size_t simd_resume = length;
+#endif
+#ifdef UTF8CHK_DFA_KERNEL
+    /* transitions for the flags. */
+    utf8chk_dfa_t dfa;
+
+    /* the kernel is run whenever length drops to this or below. */
+    size_t dfa_resume = length >= UTF8CHK_DFA_MIN ? length : 0;
+    if (dfa_resume) utf8chk_dfa_build(&dfa, flags, null_terminated);
+#endif
+
+    while (length) {
+        /* byte read. */
+        unsigned char c = *p;
+        /* length of the sequence. */
+        unsigned n;
+        /* decoded codepoint. */
+        utf8chk_uchar_t u;
+
+#ifdef UTF8CHK_SIMD_KERNEL
+        if (length <= simd_resume && !null_terminated
+                                  && !state->expect_low_surrogate) {
+            /* let the kernel skip over as much as it can. it only stops
+               at sequence boundaries, after which nothing is pending. */
+            size_t skip = utf8chk_simd_kernel(p, length, simd_mode);
+            UTF8CHK_STATS_ADD(kernel_bytes, skip);
+            p += skip, length -= skip;
+            if (!length) break;
+            c = *p;
+            simd_resume = length > UTF8CHK_SIMD_RETRY
+                        ? length - UTF8CHK_SIMD_RETRY : 0;
+        }
+#endif
+
+#ifdef UTF8CHK_DFA_KERNEL
+        if (length <= dfa_resume && !state->expect_low_surrogate) {
+            /* let the kernel skip over as much as it can. it only stops
+               at sequence boundaries, after which nothing is pending. */
+            size_t skip = utf8chk_dfa_kernel(&dfa, p, length,
+                    null_terminated || (flags & UTF8CHK_BAN_NULL_BYTE));
+            UTF8CHK_STATS_ADD(kernel_bytes, skip);
+            p += skip, length -= skip;
+            if (!length) break;
+            c = *p;
+            dfa_resume = length > UTF8CHK_DFA_RETRY
+                       ? length - UTF8CHK_DFA_RETRY : 0;
+        }
+#endif
+
+        /* Terminate if string is null-terminated
+           and null terminator found. */
+        if (!c && null_terminated) break;
+
+#ifndef UTF8CHK_NO_WORD_SCAN
+        if (c && c < 0x80U && length > sizeof(utf8chk_word_t)) {
+            /* skip over an ASCII run, the rest of it a word at a time.
+               ASCII needs no checks, but leaves any preceding high
+               surrogate unpaired. */
+            size_t run = 1 + utf8chk_ascii_run(p + 1, length - 1,
+                    null_terminated || (flags & UTF8CHK_BAN_NULL_BYTE));
+            UTF8CHK_STATS_ADD(ascii_bytes, run);
+            p += run, length -= run;
+            state->expect_low_surrogate = 0;
+            state->n_prev = 1;
+            continue;
+        }
+#endif
+
+        err = utf8chk_decode(state, p, length, null_terminated, flags,
+                             &n, &u, error_at, error_len);
+        if (err) break;
+
+        /* should you wish to decode the string, u is the code point
+           decoded once code reaches this point (or UTF8CHK_NO_OUTPUT
+           after a high surrogate). */
+
+        /* advance pointer and decrease length. */
+        p += n, length -= n;
+    }
+
+#ifdef UTF8CHK_STATS
+    utf8chk_stats_bytes(ascii_bytes, kernel_bytes,
+                        (size_t)(p - *pp) - ascii_bytes - kernel_bytes);
+#endif
+    *pp = p;
+    return err;
+}
+
+#ifdef UTF8CHK_SIMD_KERNEL
+/* utf8chk_run on a null-terminated string. The vector kernel needs to know
+   where the string ends, so the terminator is looked for a block at a
+   time, and each block is validated while it is still in the cache. */
+static UTF8CHK_INLINE utf8chk_error_t utf8chk_run_cstring(
+        utf8chk_state_t *state, const unsigned char **pp,
+        utf8chk_flag_t flags, const char **error_at, size_t *error_len) {
+    utf8chk_error_t err;
+    size_t block;
+
+    do {
+        block = utf8chk_simd_strnlen(*pp, UTF8CHK_CSTRING_BLOCK);
+        err = utf8chk_run(state, pp, block, 0, flags, error_at, error_len);
+        switch (err) {
+        case UTF8CHK_ERR_TRUNC:
+        case UTF8CHK_ERR_TRUNC2:
+        case UTF8CHK_ERR_TRUNC3:
+        case UTF8CHK_ERR_SURROGATE_TRUNC:
+        case UTF8CHK_ERR_SURROGATE_TRUNC2:
+        case UTF8CHK_ERR_SURROGATE_TRUNC3:
+            /* cut short by the block, in which case the next block starts
+               from the sequence, or by the terminator, which utf8chk_run
+               tells apart from a missing continuation byte. */
+            if (block < UTF8CHK_CSTRING_BLOCK)
+                return utf8chk_run(state, pp, UTF8CHK_CSTRING, 1, flags,
+                                   error_at, error_len);
+            err = UTF8CHK_OK;
+            break;
+        default:
+            break;
+        }
+    } while (!err && block == UTF8CHK_CSTRING_BLOCK);
+    return err;
+}
+#endif
+
+/* Validates the whole string, as documented for utf8chk. Inlined into
+   utf8chk and each of the specialized entry points below, so that constant
+   flags fold away. */
+static UTF8CHK_INLINE utf8chk_error_t utf8chk_check_string(
+        const char *string, size_t length, int null_terminated,
+        utf8chk_flag_t flags, const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    utf8chk_error_t err;
+
+    UTF8CHK_STATE_INIT(state);
+#ifdef UTF8CHK_SIMD_KERNEL
+    if (null_terminated)
+        err = utf8chk_run_cstring(&state, &p, flags, error_at, error_len);
+    else
+#endif
+        err = utf8chk_run(&state, &p, length, null_terminated,
+                          flags, error_at, error_len);
+    if (err) return err;
+
+    /* end of string and no low surrogate found.
+       shift back to the high surrogate. */
+    if ((flags & UTF8CHK_CHECK_SURROGATES) && state.expect_low_surrogate)
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_TRUNC,
+                             p - state.n_prev, state.n_prev);
+
+    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+}
+
+#ifdef UTF8CHK_STATS
+/* utf8chk_check_string, with the call counted for this thread. */
+static UTF8CHK_INLINE utf8chk_error_t utf8chk_check(const char *string,
+        size_t length, int null_terminated, utf8chk_flag_t flags,
+        const char **error_at, size_t *error_len) {
+    utf8chk_count_t started = utf8chk_stats_clock();
+    utf8chk_error_t err = utf8chk_check_string(string, length,
+            null_terminated, flags, error_at, error_len);
+    utf8chk_stats_call(err, started);
+    return err;
+}
+#else
+#define utf8chk_check utf8chk_check_string
+#endif
+
+/* the presets as constant expressions, for case labels. these must match
+   UTF8CHK_UTF8 and the others above. */
+#define UTF8CHK_PRESET_UTF8 (UTF8CHK_BAN_OVERLONG | UTF8CHK_BAN_SURROGATES)
+#define UTF8CHK_PRESET_MUTF8                                                   \
+            (UTF8CHK_BAN_OVERLONG_EXCEPT_NULL | UTF8CHK_CHECK_SURROGATES)
+#define UTF8CHK_PRESET_CESU8                                                   \
+            (UTF8CHK_BAN_OVERLONG | UTF8CHK_CHECK_SURROGATES)
+#define UTF8CHK_PRESET_WTF8 (UTF8CHK_BAN_OVERLONG)
+
+#ifdef UTF8CHK_STATIC
+#define UTF8CHK_SPECIALIZED static
+#else
+#define UTF8CHK_SPECIALIZED
+#endif
+
+/* defines name and name_cstr, which validate with the given flags. */
+#define UTF8CHK_SPECIALIZE(name, flags)                                        \
+    UTF8CHK_SPECIALIZED utf8chk_error_t name##_cstr(const char *string,        \
+            const char **error_at, size_t *error_len) {                        \
+        return utf8chk_check(string, UTF8CHK_CSTRING, 1,                       \
+                             (utf8chk_flag_t)(flags), error_at, error_len);    \
+    }                                                                          \
+                                                                               \
+    UTF8CHK_SPECIALIZED utf8chk_error_t name(const char *string,               \
+            size_t length, const char **error_at, size_t *error_len) {         \
+        if (length == UTF8CHK_CSTRING)                                         \
+            return name##_cstr(string, error_at, error_len);                   \
+        return utf8chk_check(string, length, 0,                                \
+                             (utf8chk_flag_t)(flags), error_at, error_len);    \
+    }
+
+/* see the declarations above. */
+UTF8CHK_SPECIALIZE(utf8chk_lax, UTF8CHK_LAX)
+UTF8CHK_SPECIALIZE(utf8chk_utf8, UTF8CHK_PRESET_UTF8)
+UTF8CHK_SPECIALIZE(utf8chk_mutf8, UTF8CHK_PRESET_MUTF8)
+UTF8CHK_SPECIALIZE(utf8chk_cesu8, UTF8CHK_PRESET_CESU8)
+UTF8CHK_SPECIALIZE(utf8chk_wtf8, UTF8CHK_PRESET_WTF8)
+UTF8CHK_SPECIALIZE(utf8chk_strict, UTF8CHK_STRICT)
+
+/** Validates that the string in a buffer is valid UTF-8;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk(const char *string, size_t length,
+    utf8chk_flag_t flags, const char **error_at, size_t *error_len) {
+    /* the presets go to their specialized versions. */
+    switch ((int)flags) {
+    case UTF8CHK_LAX:
+        return utf8chk_lax(string, length, error_at, error_len);
+    case UTF8CHK_PRESET_UTF8:
+        return utf8chk_utf8(string, length, error_at, error_len);
+    case UTF8CHK_PRESET_MUTF8:
+        return utf8chk_mutf8(string, length, error_at, error_len);
+    case UTF8CHK_PRESET_CESU8:
+        return utf8chk_cesu8(string, length, error_at, error_len);
+    case UTF8CHK_PRESET_WTF8:
+        return utf8chk_wtf8(string, length, error_at, error_len);
+    case UTF8CHK_STRICT:
+        return utf8chk_strict(string, length, error_at, error_len);
+    default:
+        return utf8chk_check(string, length, length == UTF8CHK_CSTRING,
+                             flags, error_at, error_len);
+    }
+}
+
+/** Returns the name of an error code; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+const char *utf8chk_strerr(utf8chk_error_t err) {
+    switch (err) {
+    case UTF8CHK_OK:
+        return "UTF8CHK_OK";
+    case UTF8CHK_ERR_UNEXPECTED_CONT:
+        return "UTF8CHK_ERR_UNEXPECTED_CONT";
+    case UTF8CHK_ERR_INVALID_START_BYTE:
+        return "UTF8CHK_ERR_INVALID_START_BYTE";
+    case UTF8CHK_ERR_RANGE:
+        return "UTF8CHK_ERR_RANGE";
+    case UTF8CHK_ERR_OVERLONG:
+        return "UTF8CHK_ERR_OVERLONG";
+    case UTF8CHK_ERR_NONCHARACTER:
+        return "UTF8CHK_ERR_NONCHARACTER";
+    case UTF8CHK_ERR_SURROGATE:
+        return "UTF8CHK_ERR_SURROGATE";
+    case UTF8CHK_ERR_SURROGATE_LOW:
+        return "UTF8CHK_ERR_SURROGATE_LOW";
+    case UTF8CHK_ERR_SURROGATE_HIGH:
+        return "UTF8CHK_ERR_SURROGATE_HIGH";
+    case UTF8CHK_ERR_NULL_BYTE:
+        return "UTF8CHK_ERR_NULL_BYTE";
+    case UTF8CHK_ERR_EXPECTED_CONT:
+        return "UTF8CHK_ERR_EXPECTED_CONT";
+    case UTF8CHK_ERR_EXPECTED_CONT2:
+        return "UTF8CHK_ERR_EXPECTED_CONT2";
+    case UTF8CHK_ERR_EXPECTED_CONT3:
+        return "UTF8CHK_ERR_EXPECTED_CONT3";
+    case UTF8CHK_ERR_TRUNC:
+        return "UTF8CHK_ERR_TRUNC";
+    case UTF8CHK_ERR_TRUNC2:
+        return "UTF8CHK_ERR_TRUNC2";
+    case UTF8CHK_ERR_TRUNC3:
+        return "UTF8CHK_ERR_TRUNC3";
+    case UTF8CHK_ERR_SURROGATE_TRUNC:
+        return "UTF8CHK_ERR_SURROGATE_TRUNC";
+    case UTF8CHK_ERR_SURROGATE_TRUNC2:
+        return "UTF8CHK_ERR_SURROGATE_TRUNC2";
+    case UTF8CHK_ERR_SURROGATE_TRUNC3:
+        return "UTF8CHK_ERR_SURROGATE_TRUNC3";
+    case UTF8CHK_ERR_NO_SPACE:
+        return "UTF8CHK_ERR_NO_SPACE";
+    case UTF8CHK_ERR_UNREPRESENTABLE:
+        return "UTF8CHK_ERR_UNREPRESENTABLE";
+    default:
+        return "<\?\?\?>";
+    }
+}
+
+#ifndef UTF8CHK_SIMD_KERNEL
+/* how many bytes utf8chk_valid_kernel checks before it looks at whether
+   it has found anything. */
+#define UTF8CHK_VALID_BLOCK 64
+
+/* The lookup tables of the vector kernel used one byte at a time, for
+   utf8chk_valid when there is no vector kernel. The error bits of each
+   byte are ORed together and only looked at once per block, so that
+   nothing but the loop itself branches. Returns the length of the prefix
+   known to be valid, like the vector kernel. Does not check for
+   noncharacters. */
+static size_t utf8chk_valid_kernel(const unsigned char *p, size_t length,
+                                   unsigned mode) {
+    const unsigned char *t2 = utf8chk_simd_byte_1_low[mode & 3];
+    int ban_null = (mode & UTF8CHK_SIMD_BAN_NULL_BYTE) != 0;
+    /* the last three bytes of the previous block. */
+    unsigned prev1 = 0, prev2 = 0, prev3 = 0;
+    size_t start = 0;
+
+    while (start < length) {
+        size_t end = length - start > UTF8CHK_VALID_BLOCK
+                        ? start + UTF8CHK_VALID_BLOCK : length;
+        unsigned error = 0;
+        size_t k = start;
+        int ascii;
+
+#ifndef UTF8CHK_NO_WORD_SCAN
+        k += utf8chk_ascii_run(p + start, end - start, ban_null);
+#endif
+        while (k < end && p[k] < 0x80U && (p[k] || !ban_null))
+            ++k;
+        ascii = k == end;
+        if (!ascii && ban_null)
+            for (k = start; k < end; ++k)
+                error |= !p[k];
+
+        if (ascii) {
+            /* only a sequence left open by the previous block
+               can be an error. */
+            error |= (prev1 >= 0xC0U) | (prev2 >= 0xE0U) | (prev3 >= 0xF0U);
+            prev1 = prev2 = prev3 = 0;
+        } else {
+            for (k = start; k < end; ++k) {
+                unsigned c = p[k];
+                /* see utf8chk_sse_check. */
+                error |= (utf8chk_simd_byte_1_high[prev1 >> 4]
+                            & t2[prev1 & 0x0FU]
+                            & utf8chk_simd_byte_2_high[c >> 4])
+                       ^ (((prev2 >= 0xE0U) | (prev3 >= 0xF0U)) << 7);
+                prev3 = prev2, prev2 = prev1, prev1 = c;
+            }
+        }
+
+        if (end == length)
+            error |= (prev1 >= 0xC0U) | (prev2 >= 0xE0U) | (prev3 >= 0xF0U);
+        if (error)
+            return utf8chk_simd_boundary(p, start);
+#ifndef UTF8CHK_NO_WORD_SCAN
+        if (ascii)
+            /* more ASCII is likely to follow. */
+            end += utf8chk_ascii_run(p + end, length - end, ban_null);
+#endif
+        start = end;
+    }
+    return length;
+}
+#endif
+
+/* Returns the length of a null-terminated string. */
+static size_t utf8chk_strlen(const char *string) {
+#ifdef UTF8CHK_SIMD_KERNEL
+    return utf8chk_simd_strnlen((const unsigned char *)string, (size_t)-1);
+#else
+    const char *p = string;
+    while (*p) ++p;
+    return (size_t)(p - string);
+#endif
+}
+
+/* Returns the length of a prefix of the string that is known to be valid
+   with the flags and ends at a sequence boundary with nothing pending,
+   found without keeping track of where any error is. */
+static size_t utf8chk_valid_prefix(const unsigned char *p, size_t length,
+                                   utf8chk_flag_t flags) {
+    size_t valid;
+#ifdef UTF8CHK_SIMD_KERNEL
+    valid = utf8chk_simd_kernel(p, length, utf8chk_simd_mode(flags));
+#else
+    /* possible noncharacters (anything with BF BE, BF BF or EF B7 in it)
+       turn up too often in text for the lookups to pay off when they are
+       banned, so utf8chk is left to check those by itself. */
+    if (flags & UTF8CHK_BAN_NONCHARACTERS)
+        return 0;
+    valid = utf8chk_valid_kernel(p, length, utf8chk_simd_mode(flags));
+#endif
+#ifdef UTF8CHK_STATS
+    utf8chk_stats_bytes(0, valid, 0);
+#endif
+    return valid;
+}
+
+/** Returns whether the string is valid; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+int utf8chk_valid(const char *string, size_t length, utf8chk_flag_t flags) {
+    size_t skip;
+
+    /* a null-terminated string is valid exactly when its bytes before the
+       terminator are. */
+    if (length == UTF8CHK_CSTRING)
+        length = utf8chk_strlen(string);
+
+    skip = utf8chk_valid_prefix((const unsigned char *)string, length, flags);
+    if (skip == length)
+        return 1;
+
+    /* let utf8chk decide about the rest. */
+    return utf8chk(string + skip, length - skip, flags, NULL, NULL)
+                == UTF8CHK_OK;
+}
+
+/* Returns the length of the sequence that starts with the given byte,
+   which must be 0xC0 - 0xF7. */
+static unsigned utf8chk_sequence_length(unsigned char c) {
+    return c < 0xE0U ? 2 : c < 0xF0U ? 3 : 4;
+}
+
+/* Returns nonzero if the valid sequence at p encodes a code point beyond
+   U+FFFF by itself: a four-byte sequence that is not overlong, which
+   starts with F0 90 - F4 8F. A code point beyond U+FFFF decoded from
+   any other sequence is that of a surrogate pair, at its low surrogate. */
+static int utf8chk_beyond_bmp(const unsigned char *p) {
+    return p[0] >= 0xF0U && (p[0] > 0xF0U || p[1] >= 0x90U);
+}
+
+#define UTF8CHK_STREAM_ERROR(stream, err, at, len) do {                       \
+                    (stream)->error = (err);                                   \
+                    (stream)->error_at = (at);                                 \
+                    (stream)->error_len = (len);                               \
+                    if (error_at) *error_at = (at);                            \
+                    if (error_len) *error_len = (len);                         \
+                    return (err);                                              \
+                } while (0)
+
+/** Prepares a stream for validation with the given flags.
+    The stream is then fed with utf8chk_stream_feed any number of times,
+    and finally ended with utf8chk_stream_finish. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+void utf8chk_stream_init(utf8chk_stream_t *stream, utf8chk_flag_t flags) {
+    UTF8CHK_STATE_INIT(stream->state);
+    stream->flags = flags;
+    stream->offset = 0;
+    stream->error = UTF8CHK_OK;
+    stream->error_at = stream->error_len = 0;
+    stream->n_pending = 0;
+}
+
+/** Validates the next chunk of a stream; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_stream_feed(utf8chk_stream_t *stream,
+            const char *chunk, size_t length,
+            size_t *error_at, size_t *error_len) {
+    const unsigned char *p = (const unsigned char *)chunk;
+    const char *seq_at;
+    size_t seq_len = 0;
+    unsigned n;
+    utf8chk_uchar_t u;
+    utf8chk_error_t err;
+
+    if (stream->error)
+        UTF8CHK_STREAM_ERROR(stream, stream->error,
+                             stream->error_at, stream->error_len);
+
+    if (stream->n_pending) {
+        /* complete the sequence cut off by the end of the last chunk. */
+        size_t pending_at = stream->offset - stream->n_pending;
+        unsigned need = utf8chk_sequence_length(stream->pending[0]);
+        while (stream->n_pending < need && length) {
+            stream->pending[stream->n_pending++] = *p++;
+            --length, ++stream->offset;
+        }
+        if (stream->n_pending < need) {
+            /* still incomplete. */
+            if (error_at) *error_at = stream->offset;
+            if (error_len) *error_len = 0;
+            return UTF8CHK_OK;
+        }
+
+        err = utf8chk_decode(&stream->state, stream->pending, need, 0,
+                             stream->flags, &n, &u, &seq_at, &seq_len);
+        if (err)
+            UTF8CHK_STREAM_ERROR(stream, err, pending_at + (size_t)(
+                seq_at - (const char *)stream->pending), seq_len);
+        stream->n_pending = 0;
+    }
+
+    /* the error position is left out: for UTF8CHK_ERR_SURROGATE_TRUNC,
+       it is the high surrogate, which may be in an earlier chunk, while
+       the other errors are at the sequence p is left at. */
+    chunk = (const char *)p;
+    err = utf8chk_run(&stream->state, &p, length, 0, stream->flags,
+                      NULL, &seq_len);
+    switch (err) {
+    case UTF8CHK_OK:
+        break;
+    case UTF8CHK_ERR_TRUNC:
+    case UTF8CHK_ERR_TRUNC2:
+    case UTF8CHK_ERR_TRUNC3:
+    case UTF8CHK_ERR_SURROGATE_TRUNC:
+    case UTF8CHK_ERR_SURROGATE_TRUNC2:
+    case UTF8CHK_ERR_SURROGATE_TRUNC3:
+        /* the chunk ends in the middle of a sequence (perhaps one
+           expected to be a low surrogate); keep it for the next chunk. */
+        while ((const char *)p != chunk + length)
+            stream->pending[stream->n_pending++] = *p++;
+        break;
+    default:
+        UTF8CHK_STREAM_ERROR(stream, err, stream->offset + (size_t)(
+                (const char *)p - chunk), seq_len);
+    }
+
+    stream->offset += length;
+    if (error_at) *error_at = stream->offset;
+    if (error_len) *error_len = 0;
+    return UTF8CHK_OK;
+}
+
+/** Ends a stream; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_stream_finish(utf8chk_stream_t *stream,
+            size_t *error_at, size_t *error_len) {
+    /* start of the incomplete sequence, if any. */
+    size_t end = stream->offset - stream->n_pending;
+    utf8chk_state_t *state = &stream->state;
+
+    if (stream->error)
+        UTF8CHK_STREAM_ERROR(stream, stream->error,
+                             stream->error_at, stream->error_len);
+
+    if (stream->n_pending) {
+        /* truncated. return the appropriate error code. */
+        unsigned missing = utf8chk_sequence_length(stream->pending[0])
+                         - stream->n_pending;
+        static const utf8chk_error_t trunc[] = {
+            UTF8CHK_ERR_TRUNC, UTF8CHK_ERR_TRUNC2, UTF8CHK_ERR_TRUNC3
+        };
+        static const utf8chk_error_t surrogate_trunc[] = {
+            UTF8CHK_ERR_SURROGATE_TRUNC, UTF8CHK_ERR_SURROGATE_TRUNC2,
+            UTF8CHK_ERR_SURROGATE_TRUNC3
+        };
+        if (state->expect_low_surrogate)
+            UTF8CHK_STREAM_ERROR(stream, surrogate_trunc[missing - 1],
+                                 end - state->n_prev, state->n_prev);
+        UTF8CHK_STREAM_ERROR(stream, trunc[missing - 1],
+                             end, stream->n_pending);
+    }
+
+    /* end of stream and no low surrogate found.
+       shift back to the high surrogate. */
+    if ((stream->flags & UTF8CHK_CHECK_SURROGATES)
+                && state->expect_low_surrogate)
+        UTF8CHK_STREAM_ERROR(stream, UTF8CHK_ERR_SURROGATE_TRUNC,
+                             end - state->n_prev, state->n_prev);
+
+    if (error_at) *error_at = end;
+    if (error_len) *error_len = 0;
+    return UTF8CHK_OK;
+}
+
+#ifndef UTF8CHK_PARALLEL_MAX
+/* the most chunks utf8chk_parallel splits a string into. */
+#define UTF8CHK_PARALLEL_MAX 64
+#endif
+
+#ifndef UTF8CHK_PARALLEL_MIN_CHUNK
+/* the shortest chunk utf8chk_parallel splits a string into. */
+#define UTF8CHK_PARALLEL_MIN_CHUNK 65536
+#endif
+
+/* a chunk of a string validated by utf8chk_parallel. */
+typedef struct utf8chk_chunk {
+    const unsigned char *p;
+    size_t length;
+    utf8chk_flag_t flags;
+    /* state at the start of the chunk, and at the end once validated. */
+    utf8chk_state_t state;
+    utf8chk_error_t err;
+} utf8chk_chunk_t;
+
+static void utf8chk_chunk_job(void *arg, size_t index) {
+    utf8chk_chunk_t *chunk = (utf8chk_chunk_t *)arg + index;
+    const unsigned char *p = chunk->p;
+    chunk->err = utf8chk_run(&chunk->state, &p, chunk->length, 0,
+                             chunk->flags, NULL, NULL);
+}
+
+/* Sets up the state at p, a sequence boundary in the string that starts
+   at s, assuming that the string is valid up to p. Only a high surrogate
+   right before p carries over, so the sequence that ends at p is decoded
+   to find out whether it is one (it may be three bytes long, or four
+   if overlong). */
+static void utf8chk_state_at(utf8chk_state_t *state, const unsigned char *s,
+                             const unsigned char *p, utf8chk_flag_t flags) {
+    const unsigned char *q = p;
+    unsigned n;
+    utf8chk_uchar_t u;
+
+    UTF8CHK_STATE_INIT(*state);
+    if (!(flags & UTF8CHK_CHECK_SURROGATES))
+        return;
+    while (q != s && p - q < 3 && (q[-1] & 0xC0U) == 0x80U)
+        --q;
+    if (q == s || p - q < 2)
+        return;
+    --q;
+    if (utf8chk_decode(state, q, (size_t)(p - q), 0, flags, &n, &u,
+                       NULL, NULL)
+            || n != (unsigned)(p - q) || !state->expect_low_surrogate)
+        UTF8CHK_STATE_INIT(*state);
+}
+
+/* Returns the first position at or after at that is not a continuation
+   byte. UTF-8 is self-synchronizing, so a sequence starts there unless the
+   string is invalid; more than three continuation bytes in a row always
+   are, so the search gives up after that. */
+static size_t utf8chk_resync(const unsigned char *s, size_t length,
+                             size_t at) {
+    unsigned i;
+    for (i = 0; i < 3 && at < length && (s[at] & 0xC0U) == 0x80U; ++i)
+        ++at;
+    return at;
+}
+
+#ifdef UTF8CHK_THREADS
+typedef struct utf8chk_thread_arg {
+    utf8chk_job_t job;
+    void *arg;
+    size_t index;
+} utf8chk_thread_arg_t;
+
+static void *utf8chk_thread(void *arg) {
+    utf8chk_thread_arg_t *t = (utf8chk_thread_arg_t *)arg;
+    t->job(t->arg, t->index);
+    return NULL;
+}
+#endif
+
+/* The executor used by utf8chk_parallel if none is given. */
+static void utf8chk_default_executor(void *context, utf8chk_job_t job,
+                                     void *arg, size_t count) {
+    size_t i;
+#ifdef UTF8CHK_THREADS
+    pthread_t threads[UTF8CHK_PARALLEL_MAX];
+    utf8chk_thread_arg_t args[UTF8CHK_PARALLEL_MAX];
+    int started[UTF8CHK_PARALLEL_MAX];
+
+    (void)context;
+    /* the calling thread takes the first job. if a thread cannot be
+       created, its job is run in the calling thread instead. */
+    for (i = 1; i < count; ++i) {
+        args[i].job = job, args[i].arg = arg, args[i].index = i;
+        started[i] = !pthread_create(&threads[i], NULL,
+                                     utf8chk_thread, &args[i]);
+        if (!started[i]) job(arg, i);
+    }
+    job(arg, 0);
+    for (i = 1; i < count; ++i)
+        if (started[i]) pthread_join(threads[i], NULL);
+#else
+    (void)context;
+    for (i = 0; i < count; ++i)
+        job(arg, i);
+#endif
+}
+
+/** Validates a string in parallel chunks; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_parallel(const char *string, size_t length,
+            utf8chk_flag_t flags, const char **error_at, size_t *error_len,
+            unsigned threads, utf8chk_executor_t executor, void *context) {
+    const unsigned char *s = (const unsigned char *)string;
+    utf8chk_chunk_t chunks[UTF8CHK_PARALLEL_MAX];
+    size_t count = threads, k, at = 0;
+    const unsigned char *p;
+    utf8chk_state_t state;
+    utf8chk_error_t err;
+
+    /* the length of a null-terminated string is not known in advance. */
+    if (length == UTF8CHK_CSTRING) count = 1;
+    if (count > UTF8CHK_PARALLEL_MAX) count = UTF8CHK_PARALLEL_MAX;
+    if (count > length / UTF8CHK_PARALLEL_MIN_CHUNK)
+        count = length / UTF8CHK_PARALLEL_MIN_CHUNK;
+    if (count <= 1) return utf8chk(string, length, flags, error_at, error_len);
+
+    /* split the string at sequence boundaries. each chunk starts in the
+       state that the string would have there if it were valid so far. */
+    for (k = 0; k < count; ++k) {
+        size_t next = k + 1 < count
+                    ? utf8chk_resync(s, length, length / count * (k + 1))
+                    : length;
+        if (next < at) next = at;
+        chunks[k].p = s + at;
+        chunks[k].length = next - at;
+        chunks[k].flags = flags;
+        chunks[k].err = UTF8CHK_OK;
+        utf8chk_state_at(&chunks[k].state, s, s + at, flags);
+        at = next;
+    }
+
+    (executor ? executor : utf8chk_default_executor)(
+            context, utf8chk_chunk_job, chunks, count);
+
+    for (k = 0; k < count && !chunks[k].err; ++k)
+        ;
+
+    if (k < count) {
+        /* the chunks before this one are valid, so it starts in the state
+           the one before it ended in. validate serially from there on to
+           report the error just like utf8chk would: a chunk that ends in
+           the middle of a sequence has an error near the start of
+           the next one. */
+        p = chunks[k].p;
+        if (k)
+            state = chunks[k - 1].state;
+        else
+            UTF8CHK_STATE_INIT(state);
+        err = utf8chk_run(&state, &p, length - (size_t)(p - s), 0,
+                          flags, error_at, error_len);
+        if (err) return err;
+    } else {
+        p = s + length;
+        state = chunks[count - 1].state;
+    }
+
+    /* end of string and no low surrogate found.
+       shift back to the high surrogate. */
+    if ((flags & UTF8CHK_CHECK_SURROGATES) && state.expect_low_surrogate)
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_TRUNC,
+                             p - state.n_prev, state.n_prev);
+
+    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+}
+
+/* Widens the ASCII run at the start of p (at most length bytes) into
+   code points in out, stopping before any null byte if stop_at_null
+   is set. Returns the number of bytes widened. All length bytes must
+   be readable. */
+static size_t utf8chk_widen_ascii(const unsigned char *p, size_t length,
+                                  int stop_at_null, utf8chk_uchar_t *out) {
+    size_t i = 0;
+
+#if defined(UTF8CHK_WIDEN_SSE2)
+    if (sizeof(utf8chk_uchar_t) == 4) {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i lo, hi;
+            int mask = _mm_movemask_epi8(v);
+            if (stop_at_null)
+                mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+            if (mask) break;
+            lo = _mm_unpacklo_epi8(v, zero);
+            hi = _mm_unpackhi_epi8(v, zero);
+            _mm_storeu_si128((__m128i *)(out + i),
+                             _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(out + i + 4),
+                             _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(out + i + 8),
+                             _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i *)(out + i + 12),
+                             _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+#elif defined(UTF8CHK_SIMD_NEON)
+    if (sizeof(utf8chk_uchar_t) == 4) {
+        for (; i + 16 <= length; i += 16) {
+            uint8x16_t v = vld1q_u8(p + i);
+            uint16x8_t lo, hi;
+            if (vmaxvq_u8(v) >= 0x80U || (stop_at_null && !vminvq_u8(v)))
+                break;
+            lo = vmovl_u8(vget_low_u8(v));
+            hi = vmovl_u8(vget_high_u8(v));
+            vst1q_u32((uint32_t *)(out + i), vmovl_u16(vget_low_u16(lo)));
+            vst1q_u32((uint32_t *)(out + i + 4), vmovl_u16(vget_high_u16(lo)));
+            vst1q_u32((uint32_t *)(out + i + 8), vmovl_u16(vget_low_u16(hi)));
+            vst1q_u32((uint32_t *)(out + i + 12), vmovl_u16(vget_high_u16(hi)));
+        }
+    }
+#endif
+
+    for (; i < length; ++i) {
+        unsigned char c = p[i];
+        if (c >= 0x80U || (!c && stop_at_null)) break;
+        out[i] = c;
+    }
+    return i;
+}
+
+/** Validates and decodes a string into code points;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_decode32(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_uchar_t *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* whether string is null-terminated. */
+    int null_terminated = length == UTF8CHK_CSTRING;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    /* number of code points written. */
+    size_t written = 0;
+
+    utf8chk_error_t err = UTF8CHK_OK;
+
+    UTF8CHK_STATE_INIT(state);
+    while (length) {
+        /* byte read. */
+        unsigned char c = *p;
+        /* length of the sequence. */
+        unsigned n;
+        /* decoded codepoint. */
+        utf8chk_uchar_t u;
+        /* state before the sequence. */
+        utf8chk_state_t prev = state;
+        /* whether a preceding high surrogate is left unpaired. */
+        int lone;
+
+        /* Terminate if string is null-terminated
+           and null terminator found. */
+        if (!c && null_terminated) break;
+
+        if (c && c < 0x80U && !state.expect_low_surrogate) {
+            /* widen an ASCII run. the vector loads may read ahead,
+               which is only safe if the length is known. */
+            size_t room = out_size - written, run;
+            if (!room) {
+                err = UTF8CHK_ERR_NO_SPACE;
+                UTF8CHK_SET_ERROR_AT_LEN(p, 0);
+                break;
+            }
+            if (null_terminated) {
+                run = 0;
+                while (run < room && p[run] && p[run] < 0x80U)
+                    out[written + run] = p[run], ++run;
+            } else {
+                run = utf8chk_widen_ascii(p, length < room ? length : room,
+                            flags & UTF8CHK_BAN_NULL_BYTE, out + written);
+            }
+            p += run, length -= run, written += run;
+            state.n_prev = 1;
+            continue;
+        }
+
+        err = utf8chk_decode(&state, p, length, null_terminated, flags,
+                             &n, &u, error_at, error_len);
+        if (err) break;
+
+        /* the high surrogate is paired if this sequence is the low one,
+           which decodes into the code point of the pair. */
+        lone = prev.expect_low_surrogate
+            && !(u != UTF8CHK_NO_OUTPUT && u > 0xFFFFU
+                                        && !utf8chk_beyond_bmp(p));
+        if (out_size - written < (size_t)lone + (u != UTF8CHK_NO_OUTPUT)) {
+            /* the pair is decoded together, so
+               stop at the high surrogate. */
+            err = UTF8CHK_ERR_NO_SPACE;
+            UTF8CHK_SET_ERROR_AT_LEN(prev.expect_low_surrogate
+                                     ? p - prev.n_prev : p, 0);
+            break;
+        }
+        if (lone) {
+            /* recover the high surrogate from the cached code point. */
+            out[written++] = UTF8CHK_UCHAR(0xD800)
+                    | ((prev.u_cache - UTF8CHK_UCHAR(0x10000)) >> 10U);
+        }
+        if (u != UTF8CHK_NO_OUTPUT)
+            out[written++] = u;
+
+        /* advance pointer and decrease length. */
+        p += n, length -= n;
+    }
+
+    if (out_len) *out_len = written;
+    if (err) return err;
+
+    /* end of string and no low surrogate found.
+       shift back to the high surrogate. */
+    if ((flags & UTF8CHK_CHECK_SURROGATES) && state.expect_low_surrogate)
+        UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_SURROGATE_TRUNC,
+                             p - state.n_prev, state.n_prev);
+
+    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+}
+
+/** Prepares an iterator over a string; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+void utf8chk_iter_init(utf8chk_iter_t *iter, const char *string,
+            size_t length, utf8chk_flag_t flags) {
+    iter->string = string;
+    iter->length = length;
+    iter->flags = flags;
+    iter->done = 0;
+    iter->error = UTF8CHK_OK;
+    iter->error_at = string;
+    iter->error_len = 0;
+    iter->next = iter->count = 0;
+}
+
+/* Decodes the next code points of the string into the buffer of an
+   iterator that has returned all of those decoded before. */
+static void utf8chk_iter_refill(utf8chk_iter_t *iter) {
+    size_t count, error_len;
+    const char *error_at;
+    utf8chk_error_t err = utf8chk_decode32(iter->string, iter->length,
+            iter->flags, iter->buffer, UTF8CHK_ITER_BUFFER, &count,
+            &error_at, &error_len);
+
+    iter->next = 0;
+    iter->count = (unsigned)count;
+    if (err == UTF8CHK_ERR_NO_SPACE) {
+        /* decoding continues from the error pointer, where nothing
+           is pending. */
+        if (iter->length != UTF8CHK_CSTRING)
+            iter->length -= (size_t)(error_at - iter->string);
+        iter->string = error_at;
+    } else {
+        iter->done = 1;
+        iter->error = err;
+        iter->error_at = error_at;
+        iter->error_len = error_len;
+    }
+}
+
+/** Returns the next code point of an iterator; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_iter_next(utf8chk_iter_t *iter,
+            utf8chk_uchar_t *u, const char **error_at, size_t *error_len) {
+    if (iter->next == iter->count) {
+        if (!iter->done)
+            utf8chk_iter_refill(iter);
+        if (iter->next == iter->count) {
+            *u = UTF8CHK_ITER_END;
+            UTF8CHK_RETURN_ERROR(iter->error, iter->error_at,
+                                 iter->error_len);
+        }
+    }
+    *u = iter->buffer[iter->next++];
+    return UTF8CHK_OK;
+}
+
+/* the size of the blocks that utf8chk_copy validates and then copies,
+   small enough that a block is still in the L1 cache when it is copied.
+   Must be at least 8, so that any sequence (or surrogate pair) cut short
+   by the end of a block fits in the next one. */
+#ifndef UTF8CHK_COPY_BLOCK
+#define UTF8CHK_COPY_BLOCK 16384
+#endif
+#if UTF8CHK_COPY_BLOCK < 8
+#error UTF8CHK_COPY_BLOCK must be at least 8
+#endif
+
+/* strings at least this long are copied by utf8chk_copy with non-temporal
+   stores (if SSE2 is available), which go around the cache instead of
+   filling it with a copy that will not all fit anyway. */
+#ifndef UTF8CHK_COPY_STREAM_MIN
+#define UTF8CHK_COPY_STREAM_MIN 1048576
+#endif
+
+/* Copies length bytes from p to out, with non-temporal stores if stream
+   is set and SSE2 is available, in which case the caller must issue
+   a store fence once done. */
+static void utf8chk_copy_bytes(unsigned char *out, const unsigned char *p,
+                               size_t length, int stream) {
+#if defined(UTF8CHK_WIDEN_SSE2)
+    if (stream) {
+        /* the stores must be aligned. */
+        for (; length && ((size_t)out & 15); --length)
+            *out++ = *p++;
+        for (; length >= 64; p += 64, out += 64, length -= 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)p);
+            __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(p + 48));
+            _mm_stream_si128((__m128i *)out, a);
+            _mm_stream_si128((__m128i *)(out + 16), b);
+            _mm_stream_si128((__m128i *)(out + 32), c);
+            _mm_stream_si128((__m128i *)(out + 48), d);
+        }
+        for (; length >= 16; p += 16, out += 16, length -= 16)
+            _mm_stream_si128((__m128i *)out,
+                             _mm_loadu_si128((const __m128i *)p));
+    }
+#else
+    (void)stream;
+#endif
+#if defined(__GNUC__)
+    __builtin_memcpy(out, p, length);
+#else
+    while (length--)
+        *out++ = *p++;
+#endif
+}
+
+/** Validates a string while copying it; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_copy(char *dest, const char *string,
+            size_t length, utf8chk_flag_t flags,
+            size_t *error_at, size_t *error_len) {
+    /* pointer to read bytes from, and the end of the string. */
+    const unsigned char *p = (const unsigned char *)string, *end = p + length;
+
+    /* pointer to write bytes to. */
+    unsigned char *out = (unsigned char *)dest;
+
+    /* whether to go around the cache. */
+    int stream = length >= UTF8CHK_COPY_STREAM_MIN;
+
+    utf8chk_error_t err = UTF8CHK_OK;
+    const char *at;
+    size_t len = 0;
+
+    while (p != end) {
+        size_t block = (size_t)(end - p) < UTF8CHK_COPY_BLOCK
+                     ? (size_t)(end - p) : UTF8CHK_COPY_BLOCK;
+        const unsigned char *stop = p + block;
+
+        err = utf8chk((const char *)p, block, flags, &at, &len);
+        if (err)
+            stop = (const unsigned char *)at;
+        switch (err) {
+        case UTF8CHK_ERR_TRUNC:
+        case UTF8CHK_ERR_TRUNC2:
+        case UTF8CHK_ERR_TRUNC3:
+        case UTF8CHK_ERR_SURROGATE_TRUNC:
+        case UTF8CHK_ERR_SURROGATE_TRUNC2:
+        case UTF8CHK_ERR_SURROGATE_TRUNC3:
+            /* the block may have cut the sequence (or surrogate pair)
+               short, in which case it is left for the next block. */
+            if (p + block != end)
+                err = UTF8CHK_OK, len = 0;
+            break;
+        default:
+            break;
+        }
+
+        /* copy the block while it is still in the cache. */
+        utf8chk_copy_bytes(out, p, (size_t)(stop - p), stream);
+        out += stop - p;
+        p = stop;
+        if (err) break;
+    }
+
+#if defined(UTF8CHK_WIDEN_SSE2)
+    /* order the non-temporal stores before any that follow. */
+    if (stream)
+        _mm_sfence();
+#endif
+    if (error_at) *error_at = (size_t)(p - (const unsigned char *)string);
+    if (error_len) *error_len = len;
+    return err;
+}
+
+/* Widens the ASCII run at the start of p (at most length bytes) into
+   UTF-16 code units in out, stopping before any null byte if stop_at_null
+   is set. Returns the number of bytes widened. All length bytes must
+   be readable. */
+static size_t utf8chk_widen_ascii16(const unsigned char *p, size_t length,
+                                    int stop_at_null, utf8chk_char16_t *out) {
+    size_t i = 0;
+
+#if defined(UTF8CHK_WIDEN_SSE2)
+    if (sizeof(utf8chk_char16_t) == 2) {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            int mask = _mm_movemask_epi8(v);
+            if (stop_at_null)
+                mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+            if (mask) break;
+            _mm_storeu_si128((__m128i *)(out + i),
+                             _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *)(out + i + 8),
+                             _mm_unpackhi_epi8(v, zero));
+        }
+    }
+#elif defined(UTF8CHK_SIMD_NEON)
+    if (sizeof(utf8chk_char16_t) == 2) {
+        for (; i + 16 <= length; i += 16) {
+            uint8x16_t v = vld1q_u8(p + i);
+            if (vmaxvq_u8(v) >= 0x80U || (stop_at_null && !vminvq_u8(v)))
+                break;
+            vst1q_u16((uint16_t *)(out + i), vmovl_u8(vget_low_u8(v)));
+            vst1q_u16((uint16_t *)(out + i + 8), vmovl_u8(vget_high_u8(v)));
+        }
+    }
+#endif
+
+    for (; i < length; ++i) {
+        unsigned char c = p[i];
+        if (c >= 0x80U || (!c && stop_at_null)) break;
+        out[i] = c;
+    }
+    return i;
+}
+
+/** Validates and transcodes a string into UTF-16;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_to_utf16(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_char16_t *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* whether string is null-terminated. */
+    int null_terminated = length == UTF8CHK_CSTRING;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    /* number of code units written. */
+    size_t written = 0;
+
+    utf8chk_error_t err = UTF8CHK_OK;
+
+    UTF8CHK_STATE_INIT(state);
+    while (length) {
+        /* byte read. */
+        unsigned char c = *p;
+        /* length of the sequence. */
+        unsigned n;
+        /* decoded codepoint. */
+        utf8chk_uchar_t u;
+        /* state before the sequence. */
+        utf8chk_state_t prev = state;
+
+        /* Terminate if string is null-terminated
+           and null terminator found. */
+        if (!c && null_terminated) break;
+
+        if (c && c < 0x80U) {
+            /* widen an ASCII run. the vector loads may read ahead,
+               which is only safe if the length is known. */
+            size_t room = out_size - written, run;
+            if (!room) {
+                err = UTF8CHK_ERR_NO_SPACE;
+                UTF8CHK_SET_ERROR_AT_LEN(p, 0);
+                break;
+            }
+            if (null_terminated) {
+                run = 0;
+                while (run < room && p[run] && p[run] < 0x80U)
+                    out[written + run] = p[run], ++run;
+            } else {
+                run = utf8chk_widen_ascii16(p, length < room ? length : room,
+                            flags & UTF8CHK_BAN_NULL_BYTE, out + written);
+            }
+            p += run, length -= run, written += run;
+            state.expect_low_surrogate = 0;
+            state.n_prev = 1;
+            continue;
+        }
+
+        err = utf8chk_decode(&state, p, length, null_terminated, flags,
+                             &n, &u, error_at, error_len);
+        if (err) break;
+
+        if (out_size - written < (utf8chk_beyond_bmp(p) ? 2U : 1U)) {
+            err = UTF8CHK_ERR_NO_SPACE;
+            if (prev.expect_low_surrogate) {
+                /* take back the high surrogate, so that transcoding
+                   continues with the whole pair. */
+                --written;
+                UTF8CHK_SET_ERROR_AT_LEN(p - prev.n_prev, 0);
+            } else {
+                UTF8CHK_SET_ERROR_AT_LEN(p, 0);
+            }
+            break;
+        }
+
+        if (u == UTF8CHK_NO_OUTPUT) {
+            /* high surrogate, recovered from the cached code point. */
+            out[written++] = (utf8chk_char16_t)(0xD800U
+                    | ((state.u_cache - UTF8CHK_UCHAR(0x10000)) >> 10U));
+        } else if (u > 0xFFFFU && !utf8chk_beyond_bmp(p)) {
+            /* low surrogate, combined with the high one. */
+            out[written++] = (utf8chk_char16_t)(0xDC00U | (u & 0x3FFU));
+        } else if (u > 0xFFFFU) {
+            /* beyond U+FFFF, into a surrogate pair. */
+            u -= UTF8CHK_UCHAR(0x10000);
+            out[written++] = (utf8chk_char16_t)(0xD800U | (u >> 10U));
+            out[written++] = (utf8chk_char16_t)(0xDC00U | (u & 0x3FFU));
+        } else {
+            out[written++] = (utf8chk_char16_t)u;
+        }
+
+        /* advance pointer and decrease length. */
+        p += n, length -= n;
+    }
+
+    if (!err && (flags & UTF8CHK_CHECK_SURROGATES)
+             && state.expect_low_surrogate) {
+        /* end of string and no low surrogate found.
+           shift back to the high surrogate. */
+        err = UTF8CHK_ERR_SURROGATE_TRUNC;
+        UTF8CHK_SET_ERROR_AT_LEN(p - state.n_prev, state.n_prev);
+    }
+
+    /* the error is at the high surrogate, which has been written. */
+    if (err == UTF8CHK_ERR_SURROGATE_TRUNC
+            || err == UTF8CHK_ERR_SURROGATE_TRUNC2
+            || err == UTF8CHK_ERR_SURROGATE_TRUNC3)
+        --written;
+
+    if (out_len) *out_len = written;
+    if (err) return err;
+
+    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+}
+
+/** Counts the UTF-16 code units for a string; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_utf16_length(const char *string,
+            size_t length, utf8chk_flag_t flags, size_t *out_len,
+            const char **error_at, size_t *error_len) {
+    const char *end;
+    const unsigned char *p = (const unsigned char *)string;
+    size_t count = 0;
+    utf8chk_error_t err = utf8chk(string, length, flags, &end, error_len);
+
+    if (error_at) *error_at = end;
+    if (out_len) {
+        /* up to the error, the string is valid, and every sequence is
+           one code unit (surrogates included), except that those beyond
+           U+FFFF by themselves are two, as in utf8chk_to_utf16. */
+        for (; p != (const unsigned char *)end; ++p) {
+            if ((*p & 0xC0U) != 0x80U)
+                count += 1 + utf8chk_beyond_bmp(p);
+        }
+        *out_len = count;
+    }
+    return err;
+}
+
+/* Copies the ASCII run at the start of p (at most length bytes) to out,
+   stopping before any null byte if stop_at_null is set. Returns the
+   number of bytes copied. All length bytes must be readable. */
+static size_t utf8chk_copy_ascii(const unsigned char *p, size_t length,
+                                 int stop_at_null, unsigned char *out) {
+    size_t i = 0;
+
+#if defined(UTF8CHK_WIDEN_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(v);
+        if (stop_at_null)
+            mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        if (mask) break;
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+#elif defined(UTF8CHK_SIMD_NEON)
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+        if (vmaxvq_u8(v) >= 0x80U || (stop_at_null && !vminvq_u8(v)))
+            break;
+        vst1q_u8(out + i, v);
+    }
+#endif
+
+    for (; i < length; ++i) {
+        unsigned char c = p[i];
+        if (c >= 0x80U || (!c && stop_at_null)) break;
+        out[i] = c;
+    }
+    return i;
+}
+
+/** Validates a string and narrows it into Latin-1 or ASCII;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_to_latin1(const char *string, size_t length,
+            utf8chk_flag_t flags, int ascii, char *out, size_t out_size,
+            size_t *out_len, const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* pointer to write bytes to. */
+    unsigned char *q = (unsigned char *)out;
+
+    /* whether string is null-terminated. */
+    int null_terminated = length == UTF8CHK_CSTRING;
+
+    /* the largest code point that fits. */
+    utf8chk_uchar_t limit = ascii ? 0x7FU : 0xFFU;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    /* number of bytes written. */
+    size_t written = 0;
+
+    utf8chk_error_t err = UTF8CHK_OK;
+
+    UTF8CHK_STATE_INIT(state);
+    while (length) {
+        /* byte read. */
+        unsigned char c = *p;
+        /* length of the sequence. */
+        unsigned n;
+        /* decoded codepoint. */
+        utf8chk_uchar_t u;
+
+        /* Terminate if string is null-terminated
+           and null terminator found. */
+        if (!c && null_terminated) break;
+
+        if (written == out_size) {
+            err = UTF8CHK_ERR_NO_SPACE;
+            UTF8CHK_SET_ERROR_AT_LEN(p, 0);
+            break;
+        }
+
+        if (c && c < 0x80U) {
+            /* copy an ASCII run. the vector loads may read ahead,
+               which is only safe if the length is known. */
+            size_t room = out_size - written, run;
+            if (null_terminated) {
+                run = 0;
+                while (run < room && p[run] && p[run] < 0x80U)
+                    q[written + run] = p[run], ++run;
+            } else {
+                run = utf8chk_copy_ascii(p, length < room ? length : room,
+                            flags & UTF8CHK_BAN_NULL_BYTE, q + written);
+            }
+            p += run, length -= run, written += run;
+            state.n_prev = 1;
+            continue;
+        }
+
+        if ((c & 0xFEU) == 0xC2U && length >= 2
+                                 && (p[1] & 0xC0U) == 0x80U) {
+            /* U+0080 - U+00FF, which is valid with any flags, and the
+               most common sequence in text that fits in Latin-1. */
+            u = ((utf8chk_uchar_t)(c & 0x03U) << 6) | (p[1] & 0x3FU);
+            if (u > limit) {
+                err = UTF8CHK_ERR_UNREPRESENTABLE;
+                UTF8CHK_SET_ERROR_AT_LEN(p, 2);
+                break;
+            }
+            q[written++] = (unsigned char)u;
+            p += 2, length -= 2;
+            state.n_prev = 2;
+            continue;
+        }
+
+        err = utf8chk_decode(&state, p, length, null_terminated, flags,
+                             &n, &u, error_at, error_len);
+        if (err) break;
+
+        /* a high surrogate decodes into UTF8CHK_NO_OUTPUT, and does not
+           fit either, so nothing is ever left pending. */
+        if (u > limit) {
+            err = UTF8CHK_ERR_UNREPRESENTABLE;
+            UTF8CHK_SET_ERROR_AT_LEN(p, n);
+            if (u == UTF8CHK_NO_OUTPUT) {
+                /* if the string ends before the low surrogate does,
+                   utf8chk reports that at the high surrogate, which
+                   takes precedence. */
+                const unsigned char *low = p + n;
+                if (length == n || (!*low && null_terminated)) {
+                    err = UTF8CHK_ERR_SURROGATE_TRUNC;
+                } else {
+                    const char *low_at;
+                    size_t low_len;
+                    utf8chk_error_t low_err = utf8chk_decode(&state, low,
+                            length - n, null_terminated, flags, &n, &u,
+                            &low_at, &low_len);
+                    if (low_err == UTF8CHK_ERR_SURROGATE_TRUNC
+                            || low_err == UTF8CHK_ERR_SURROGATE_TRUNC2
+                            || low_err == UTF8CHK_ERR_SURROGATE_TRUNC3) {
+                        err = low_err;
+                        UTF8CHK_SET_ERROR_AT_LEN(low_at, low_len);
+                    }
+                }
+            }
+            break;
+        }
+        q[written++] = (unsigned char)u;
+
+        /* advance pointer and decrease length. */
+        p += n, length -= n;
+    }
+
+    if (out_len) *out_len = written;
+    if (err) return err;
+
+    UTF8CHK_RETURN_ERROR(UTF8CHK_OK, p, 0);
+}
+
+/* Returns the length of the maximal subpart at p, which has length bytes
+   left: the longest run of bytes, but at least one, that could start
+   a sequence allowed by flags. The code point itself is not checked. */
+static unsigned utf8chk_subpart(const unsigned char *p, size_t length,
+                                utf8chk_flag_t flags) {
+    unsigned char c = *p;
+    /* allowed range of the next continuation byte. */
+    unsigned char lo = 0x80U, hi = 0xBFU;
+    /* expected or read length of sequence. */
+    unsigned n, i;
+
+    if (c < 0xC0U || c >= 0xF5U)
+        return 1;
+    n = c < 0xE0U ? 2 : c < 0xF0U ? 3 : 4;
+
+    /* the second byte tells apart overlong representations, surrogates
+       and code points beyond U+10FFFF. */
+    if (flags & (UTF8CHK_BAN_OVERLONG | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)) {
+        if (c == 0xC0U && !(flags & UTF8CHK_BAN_OVERLONG))
+            hi = 0x80U;
+        else if (c == 0xC0U || c == 0xC1U)
+            return 1;
+        else if (c == 0xE0U)
+            lo = 0xA0U;
+        else if (c == 0xF0U)
+            lo = 0x90U;
+    }
+    if (c == 0xEDU && (flags & UTF8CHK_BAN_SURROGATES))
+        hi = 0x9FU;
+    else if (c == 0xF4U)
+        hi = 0x8FU;
+
+    for (i = 1; i < n && i < length; ++i) {
+        c = p[i];
+        if (c < lo || c > hi) break;
+        lo = 0x80U, hi = 0xBFU;
+    }
+    return i;
+}
+
+/* Returns how much of the n valid bytes at p can be copied without
+   splitting a sequence or, with UTF8CHK_CHECK_SURROGATES,
+   a surrogate pair. */
+static size_t utf8chk_sanitize_cut(const unsigned char *p, size_t n,
+                                   utf8chk_flag_t flags) {
+    utf8chk_state_t state;
+    unsigned i;
+    for (i = 0; i < 3 && n && (p[n] & 0xC0U) == 0x80U; ++i)
+        --n;
+    utf8chk_state_at(&state, p, p + n, flags);
+    if (state.expect_low_surrogate)
+        n -= state.n_prev;
+    return n;
+}
+
+/** Repairs a string; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_sanitize(const char *string, size_t length,
+            utf8chk_flag_t flags, char *out, size_t out_size,
+            size_t *out_len, size_t *counts,
+            const char **error_at, size_t *error_len) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* whether string is null-terminated. */
+    int null_terminated = length == UTF8CHK_CSTRING;
+
+    /* whether string is repaired in place. */
+    int in_place = out == string;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    /* number of bytes written. */
+    size_t written = 0;
+
+    utf8chk_error_t err = UTF8CHK_OK;
+
+    /* set once the end of the string has been reached. */
+    int done = 0;
+
+    size_t i;
+
+    if (counts)
+        for (i = 0; i < UTF8CHK_ERR_LIMIT; ++i)
+            counts[i] = 0;
+
+    if (in_place) {
+        /* move the string to the end of the buffer,
+           so that the repairs can grow into the room before it. */
+        size_t gap;
+        if (null_terminated)
+            for (length = 0; p[length]; ++length)
+                ;
+        null_terminated = 0;
+        if (out_size < length) {
+            if (out_len) *out_len = 0;
+            UTF8CHK_RETURN_ERROR(UTF8CHK_ERR_NO_SPACE, p, 0);
+        }
+        gap = out_size - length;
+        p += gap;
+        for (i = 0; length - i; ++i)
+            out[gap + length - i - 1] = out[length - i - 1];
+    }
+
+    for (;;) {
+        /* start of the valid run. */
+        const unsigned char *start = p;
+        /* end of the valid run, and the bytes replaced by U+FFFD
+           after it. */
+        const unsigned char *end;
+        size_t replaced = 0, n;
+        utf8chk_error_t found;
+
+        UTF8CHK_STATE_INIT(state);
+        found = utf8chk_run(&state, &p, length, null_terminated, flags,
+                            NULL, NULL);
+        end = p;
+        length -= (size_t)(p - start);
+
+        switch (found) {
+        case UTF8CHK_OK:
+            done = 1;
+            /* end of string and no low surrogate found. */
+            if ((flags & UTF8CHK_CHECK_SURROGATES)
+                    && state.expect_low_surrogate) {
+                found = UTF8CHK_ERR_SURROGATE_TRUNC;
+                end -= state.n_prev;
+                replaced = state.n_prev;
+            }
+            break;
+        case UTF8CHK_ERR_SURROGATE_TRUNC:
+        case UTF8CHK_ERR_SURROGATE_TRUNC2:
+        case UTF8CHK_ERR_SURROGATE_TRUNC3:
+        case UTF8CHK_ERR_SURROGATE_HIGH:
+            /* replace the high surrogate left unpaired, and start over
+               from what follows it. */
+            end -= state.n_prev;
+            replaced = state.n_prev;
+            break;
+        default:
+            if ((flags & UTF8CHK_CHECK_SURROGATES)
+                    && state.expect_low_surrogate) {
+                /* a null terminator can make the sequence after a high
+                   surrogate the error instead; replace the high surrogate
+                   first, as with an explicit length. */
+                found = UTF8CHK_ERR_SURROGATE_TRUNC;
+                end -= state.n_prev;
+                replaced = state.n_prev;
+                break;
+            }
+            replaced = utf8chk_subpart(p, length, flags);
+            p += replaced;
+            length -= replaced;
+        }
+
+        /* copy the valid run. */
+        n = (size_t)(end - start);
+        if (out) {
+            size_t room = out_size - written;
+            if (n > room) {
+                n = utf8chk_sanitize_cut(start, room, flags);
+                p = start + n;
+                err = UTF8CHK_ERR_NO_SPACE;
+            }
+            for (i = 0; n - i; ++i)
+                out[written + i] = (char)start[i];
+        }
+        written += n;
+        if (err) break;
+
+        if (found) {
+            /* and replace the error. */
+            if (out) {
+                /* in place, the written bytes may not overtake
+                   those not yet read. */
+                size_t room = in_place ? (size_t)(end + replaced
+                                                  - (unsigned char *)out)
+                                       : out_size;
+                if (room - written < 3) {
+                    p = end;
+                    err = UTF8CHK_ERR_NO_SPACE;
+                    break;
+                }
+                out[written] = (char)0xEF;
+                out[written + 1] = (char)0xBF;
+                out[written + 2] = (char)0xBD;
+            }
+            written += 3;
+            if (counts) ++counts[found];
+        }
+
+        if (done) break;
+    }
+
+    if (out_len) *out_len = written;
+    UTF8CHK_RETURN_ERROR(err, p, 0);
+}
+
+/** Finds all errors in a string; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+size_t utf8chk_all(const char *string, size_t length,
+            utf8chk_flag_t flags, utf8chk_error_record_t *errors,
+            size_t max_errors) {
+    /* pointer to read bytes from. */
+    const unsigned char *p = (const unsigned char *)string;
+
+    /* whether string is null-terminated. */
+    int null_terminated = length == UTF8CHK_CSTRING;
+
+    /* state carried from one sequence to the next. */
+    utf8chk_state_t state;
+
+    /* number of errors found. */
+    size_t found = 0;
+
+    for (;;) {
+        const unsigned char *start = p;
+        const char *error_at;
+        size_t error_len;
+        utf8chk_error_t err;
+
+        UTF8CHK_STATE_INIT(state);
+        err = utf8chk_run(&state, &p, length, null_terminated, flags,
+                          &error_at, &error_len);
+        length -= (size_t)(p - start);
+
+        if (!err) {
+            /* end of string and no low surrogate found.
+               shift back to the high surrogate. */
+            if (!(flags & UTF8CHK_CHECK_SURROGATES)
+                    || !state.expect_low_surrogate)
+                break;
+            err = UTF8CHK_ERR_SURROGATE_TRUNC;
+            error_at = (const char *)(p - state.n_prev);
+            error_len = state.n_prev;
+        }
+
+        if (found < max_errors) {
+            errors[found].offset = (size_t)(error_at - string);
+            errors[found].length = error_len;
+            errors[found].error = err;
+        }
+        ++found;
+
+        /* continue after the error, which may be before p
+           (at a high surrogate). */
+        length += (size_t)(p - (const unsigned char *)error_at) - error_len;
+        p = (const unsigned char *)error_at + error_len;
+    }
+
+    return found;
+}
+
+/* a validation function with the flags compiled in, like utf8chk_utf8. */
+typedef utf8chk_error_t (*utf8chk_preset_fn)(const char *string,
+            size_t length, const char **error_at, size_t *error_len);
+
+/* Returns the specialized entry point for the flags,
+   or NULL if they are not one of the presets. */
+static utf8chk_preset_fn utf8chk_preset(utf8chk_flag_t flags) {
+    switch ((int)flags) {
+    case UTF8CHK_LAX:
+        return utf8chk_lax;
+    case UTF8CHK_PRESET_UTF8:
+        return utf8chk_utf8;
+    case UTF8CHK_PRESET_MUTF8:
+        return utf8chk_mutf8;
+    case UTF8CHK_PRESET_CESU8:
+        return utf8chk_cesu8;
+    case UTF8CHK_PRESET_WTF8:
+        return utf8chk_wtf8;
+    case UTF8CHK_STRICT:
+        return utf8chk_strict;
+    default:
+        return NULL;
+    }
+}
+
+/* Validates one string of a batch with preset, which was picked for the
+   flags once for the whole batch, or with utf8chk if it is NULL. */
+static utf8chk_error_t utf8chk_batch_one(utf8chk_preset_fn preset,
+        const char *string, size_t length, utf8chk_flag_t flags) {
+    /* most strings are valid, so first find out whether this one is
+       the quick way. */
+    size_t size = length == UTF8CHK_CSTRING ? utf8chk_strlen(string)
+                                            : length;
+    size_t skip = utf8chk_valid_prefix((const unsigned char *)string,
+                                       size, flags);
+    if (skip == size)
+        return UTF8CHK_OK;
+
+    string += skip;
+    if (length != UTF8CHK_CSTRING) length -= skip;
+    return preset ? preset(string, length, NULL, NULL)
+                  : utf8chk(string, length, flags, NULL, NULL);
+}
+
+/** Validates many strings; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+size_t utf8chk_batch(const char *const *strings,
+            const size_t *lengths, size_t count, utf8chk_flag_t flags,
+            utf8chk_error_t *results) {
+    utf8chk_preset_fn preset = utf8chk_preset(flags);
+    size_t i, invalid = 0;
+
+    for (i = 0; i < count; ++i) {
+        utf8chk_error_t err = utf8chk_batch_one(preset, strings[i],
+                        lengths ? lengths[i] : UTF8CHK_CSTRING, flags);
+        if (results) results[i] = err;
+        if (!err) continue;
+        ++invalid;
+        if (!results) break;
+    }
+    return invalid;
+}
+
+/** Validates a column of strings; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+size_t utf8chk_column(const char *data,
+            const utf8chk_offset_t *offsets, size_t count,
+            utf8chk_flag_t flags, utf8chk_error_record_t *error) {
+    const unsigned char *p;
+    const char *start, *error_at;
+    size_t bad = count, i, length, skip, valid, error_len;
+
+    if (!count)
+        return 0;
+
+    start = data + offsets[0];
+    p = (const unsigned char *)start;
+    valid = length = (size_t)(offsets[count] - offsets[0]);
+    skip = utf8chk_valid_prefix(p, length, flags);
+    if (skip < length && utf8chk(start + skip, length - skip, flags,
+                                 &error_at, &error_len)) {
+        /* the string that has the first error is invalid, and so may be
+           one before it, if it ends inside a sequence. */
+        size_t lo = 0, hi = count - 1;
+        valid = (size_t)(error_at - start);
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo + 1) / 2;
+            if ((size_t)(offsets[mid] - offsets[0]) <= valid)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        bad = lo;
+    }
+
+    /* the bytes before valid are made of whole sequences, so a string
+       before bad is valid by itself unless it ends inside a sequence or,
+       with UTF8CHK_CHECK_SURROGATES, with a high surrogate. */
+    for (i = 0; i < bad && i + 1 < count; ++i) {
+        size_t at = (size_t)(offsets[i + 1] - offsets[0]);
+        utf8chk_state_t state;
+        if (at < valid && (p[at] & 0xC0U) == 0x80U) {
+            bad = i;
+            break;
+        }
+        utf8chk_state_at(&state, p, p + at, flags);
+        if (state.expect_low_surrogate) {
+            bad = i;
+            break;
+        }
+    }
+
+    if (bad < count && error) {
+        start = data + offsets[bad];
+        error->error = utf8chk(start,
+                               (size_t)(offsets[bad + 1] - offsets[bad]),
+                               flags, &error_at, &error->length);
+        error->offset = (size_t)(error_at - start);
+    }
+    return bad;
+}
+
+/** Validates many strings stored one after another;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+size_t utf8chk_batch_offsets(const char *data,
+            const utf8chk_offset_t *offsets, size_t count,
+            utf8chk_flag_t flags, utf8chk_error_t *results) {
+    size_t done = 0, invalid = 0;
+
+    /* validate the strings that are left as a column, which stops at
+       the first invalid one. */
+    while (done < count) {
+        utf8chk_error_record_t error;
+        size_t bad = done + utf8chk_column(data, offsets + done,
+                                           count - done, flags, &error);
+        if (results)
+            while (done < bad)
+                results[done++] = UTF8CHK_OK;
+        if (bad == count)
+            break;
+        ++invalid;
+        if (!results)
+            break;
+        results[bad] = error.error;
+        done = bad + 1;
+    }
+    return invalid;
+}
+
+#ifndef UTF8CHK_INFO_BLOCK
+/* how many bytes utf8chk_info validates at a time before counting them,
+   so that they are still in the cache when they are counted.
+   Must be at least 8. */
+#define UTF8CHK_INFO_BLOCK 16384
+#endif
+
+/* Byte counts from which utf8chk_info works out its statistics. */
+typedef struct utf8chk_tally {
+    /* all bytes. */
+    size_t bytes;
+    /* continuation bytes, 0x80 - 0xBF. */
+    size_t cont;
+    /* bytes that start sequences of at least 2, 3 and 4 bytes. */
+    size_t lead2, lead3, lead4;
+    /* line feeds. */
+    size_t newlines;
+    /* low surrogates (ED B0 - ED BF), if counted. */
+    size_t lows;
+} utf8chk_tally_t;
+
+/* count_lows for utf8chk_tally if overlong low surrogates
+   (F0 8D B0 - F0 8D BF) are counted too. */
+#define UTF8CHK_TALLY_OVERLONG_LOWS 2
+
+#if !defined(UTF8CHK_WIDEN_SSE2) && !defined(UTF8CHK_SIMD_NEON)            \
+        && !defined(UTF8CHK_NO_WORD_SCAN)
+/* whether utf8chk_tally counts a word at a time, without vectors. */
+#define UTF8CHK_TALLY_WORDS 1
+#endif
+
+#ifdef UTF8CHK_TALLY_WORDS
+/* Returns the sum of the bytes of a word, each of which is at most 255. */
+static size_t utf8chk_word_sum(utf8chk_word_t w) {
+    /* 0x00FF00FF...00FF over the full width of a word. */
+    const utf8chk_word_t evens = (utf8chk_word_t)-1 / 0xFFFFU * 0xFFU;
+    w = (w & evens) + ((w >> 8) & evens);
+    return (size_t)((w * ((utf8chk_word_t)-1 / 0xFFFFU))
+                    >> (sizeof(utf8chk_word_t) * 8 - 16));
+}
+
+/* Returns a word with the high bit set in every byte of w equal to c. */
+static utf8chk_word_t utf8chk_word_equal(utf8chk_word_t w, unsigned char c) {
+    utf8chk_word_t x = w ^ (UTF8CHK_WORD_ONES * c);
+    return ~(((x & ~UTF8CHK_WORD_HIGHS) + ~UTF8CHK_WORD_HIGHS) | x)
+            & UTF8CHK_WORD_HIGHS;
+}
+#endif
+
+/* Adds the bytes of p to tally one at a time, except for tally->bytes.
+   See utf8chk_tally. */
+static void utf8chk_tally_bytes(const unsigned char *p, size_t length,
+                                int count_lows, utf8chk_tally_t *tally) {
+    size_t i;
+    for (i = 0; i < length; ++i) {
+        unsigned char c = p[i];
+        tally->cont += (c & 0xC0U) == 0x80U;
+        tally->lead2 += c >= 0xC0U;
+        tally->lead3 += c >= 0xE0U;
+        tally->lead4 += c >= 0xF0U;
+        tally->newlines += c == '\n';
+        tally->lows += count_lows && ((c == 0xEDU && p[i + 1] >= 0xB0U)
+                || (count_lows == UTF8CHK_TALLY_OVERLONG_LOWS && c == 0xF0U
+                    && p[i + 1] == 0x8DU && p[i + 2] >= 0xB0U));
+    }
+}
+
+/* Adds the bytes of p, which must be valid and end at a sequence boundary,
+   to tally. Low surrogates are only counted if count_lows is set, and
+   overlong ones only if it is UTF8CHK_TALLY_OVERLONG_LOWS, which is
+   rare enough that they are counted a byte at a time. */
+static void utf8chk_tally(const unsigned char *p, size_t length,
+                          int count_lows, utf8chk_tally_t *tally) {
+    size_t i = 0;
+#if defined(UTF8CHK_WIDEN_SSE2) || defined(UTF8CHK_SIMD_NEON)              \
+        || defined(UTF8CHK_TALLY_WORDS)
+    /* the byte after an ED is looked at too, so a vector or word may start
+       anywhere up to the last byte, which cannot be ED in a valid string. */
+    size_t limit = count_lows && length ? length - 1 : length;
+    if (count_lows == UTF8CHK_TALLY_OVERLONG_LOWS)
+        limit = 0;
+#endif
+
+    tally->bytes += length;
+
+#if defined(UTF8CHK_WIDEN_SSE2)
+    while (limit - i >= 16) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i cont = zero, lead2 = zero, lead3 = zero, lead4 = zero;
+        __m128i newlines = zero, lows = zero;
+        /* the byte counters in each lane can count up to 255 vectors. */
+        size_t rounds = (limit - i) / 16 < 255 ? (limit - i) / 16 : 255;
+        for (; rounds; --rounds, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i high = _mm_cmplt_epi8(v, zero), is_cont;
+            /* the masks are -1 where set, so subtracting counts them. */
+            newlines = _mm_sub_epi8(newlines,
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+            if (!_mm_movemask_epi8(high))
+                continue;
+            is_cont = _mm_cmplt_epi8(v, _mm_set1_epi8(-0x40));
+            cont = _mm_sub_epi8(cont, is_cont);
+            lead2 = _mm_sub_epi8(lead2, _mm_andnot_si128(is_cont, high));
+            lead3 = _mm_sub_epi8(lead3, _mm_and_si128(high,
+                        _mm_cmpgt_epi8(v, _mm_set1_epi8(-0x21))));
+            lead4 = _mm_sub_epi8(lead4, _mm_and_si128(high,
+                        _mm_cmpgt_epi8(v, _mm_set1_epi8(-0x11))));
+            if (count_lows) {
+                __m128i next = _mm_loadu_si128((const __m128i *)(p + i + 1));
+                lows = _mm_sub_epi8(lows, _mm_and_si128(
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8(-0x13)),
+                        _mm_cmpgt_epi8(next, _mm_set1_epi8(-0x51))));
+            }
+        }
+#define UTF8CHK_TALLY_SUM(field) do {                                          \
+                    __m128i sum = _mm_sad_epu8(field, zero);                   \
+                    tally->field += (size_t)_mm_cvtsi128_si32(sum)             \
+                        + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));   \
+                } while (0)
+        UTF8CHK_TALLY_SUM(cont);
+        UTF8CHK_TALLY_SUM(lead2);
+        UTF8CHK_TALLY_SUM(lead3);
+        UTF8CHK_TALLY_SUM(lead4);
+        UTF8CHK_TALLY_SUM(newlines);
+        UTF8CHK_TALLY_SUM(lows);
+#undef UTF8CHK_TALLY_SUM
+    }
+#elif defined(UTF8CHK_SIMD_NEON)
+    while (limit - i >= 16) {
+        uint8x16_t cont = vdupq_n_u8(0), lead2 = cont, lead3 = cont;
+        uint8x16_t lead4 = cont, newlines = cont, lows = cont;
+        /* the byte counters in each lane can count up to 255 vectors. */
+        size_t rounds = (limit - i) / 16 < 255 ? (limit - i) / 16 : 255;
+        for (; rounds; --rounds, i += 16) {
+            uint8x16_t v = vld1q_u8(p + i);
+            /* the masks are 0xFF where set, so subtracting counts them. */
+            newlines = vsubq_u8(newlines, vceqq_u8(v, vdupq_n_u8('\n')));
+            if (vmaxvq_u8(v) < 0x80U)
+                continue;
+            cont = vsubq_u8(cont, vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x80)),
+                                           vcltq_u8(v, vdupq_n_u8(0xC0))));
+            lead2 = vsubq_u8(lead2, vcgeq_u8(v, vdupq_n_u8(0xC0)));
+            lead3 = vsubq_u8(lead3, vcgeq_u8(v, vdupq_n_u8(0xE0)));
+            lead4 = vsubq_u8(lead4, vcgeq_u8(v, vdupq_n_u8(0xF0)));
+            if (count_lows)
+                lows = vsubq_u8(lows, vandq_u8(
+                        vceqq_u8(v, vdupq_n_u8(0xED)),
+                        vcgeq_u8(vld1q_u8(p + i + 1), vdupq_n_u8(0xB0))));
+        }
+        tally->cont += vaddlvq_u8(cont);
+        tally->lead2 += vaddlvq_u8(lead2);
+        tally->lead3 += vaddlvq_u8(lead3);
+        tally->lead4 += vaddlvq_u8(lead4);
+        tally->newlines += vaddlvq_u8(newlines);
+        tally->lows += vaddlvq_u8(lows);
+    }
+#elif defined(UTF8CHK_TALLY_WORDS)
+    if (limit >= 2 * sizeof(utf8chk_word_t)) {
+        /* go byte by byte until p + i is aligned. */
+        i = ((size_t)0 - (size_t)p) & (sizeof(utf8chk_word_t) - 1);
+        utf8chk_tally_bytes(p, i, count_lows, tally);
+    } else {
+        /* too short for words to pay off. */
+        limit = 0;
+    }
+    while (limit - i >= sizeof(utf8chk_word_t)) {
+        utf8chk_word_t cont = 0, lead2 = 0, lead3 = 0, lead4 = 0;
+        utf8chk_word_t newlines = 0;
+        /* the byte counters in each word can count up to 255 words. */
+        size_t rounds = (limit - i) / sizeof(utf8chk_word_t);
+        if (rounds > 255) rounds = 255;
+        for (; rounds; --rounds, i += sizeof(utf8chk_word_t)) {
+            utf8chk_word_t w = *(const utf8chk_word_t *)(p + i);
+            /* the high bits of 0x80 - 0xFF, 0xC0 - 0xFF, 0xE0 - 0xFF
+               and 0xF0 - 0xFF. */
+            utf8chk_word_t high = w & UTF8CHK_WORD_HIGHS;
+            utf8chk_word_t c0 = high & (w << 1);
+            utf8chk_word_t e0 = c0 & (w << 2);
+            utf8chk_word_t f0 = e0 & (w << 3);
+            newlines += utf8chk_word_equal(w, '\n') >> 7;
+            if (!high)
+                continue;
+            cont += (high & ~c0) >> 7;
+            lead2 += c0 >> 7;
+            lead3 += e0 >> 7;
+            lead4 += f0 >> 7;
+            if (count_lows && utf8chk_word_equal(w, 0xED)) {
+                /* rare outside of Korean, so not worth doing in the word. */
+                size_t j;
+                for (j = i; j < i + sizeof(utf8chk_word_t); ++j)
+                    tally->lows += p[j] == 0xEDU && p[j + 1] >= 0xB0U;
+            }
+        }
+        tally->cont += utf8chk_word_sum(cont);
+        tally->lead2 += utf8chk_word_sum(lead2);
+        tally->lead3 += utf8chk_word_sum(lead3);
+        tally->lead4 += utf8chk_word_sum(lead4);
+        tally->newlines += utf8chk_word_sum(newlines);
+    }
+#endif
+
+    utf8chk_tally_bytes(p + i, length - i, count_lows, tally);
+}
+
+/* Returns the number of code points counted in tally. */
+static size_t utf8chk_tally_code_points(const utf8chk_tally_t *tally) {
+    return tally->bytes - tally->cont - tally->lows;
+}
+
+/** Validates a string and gathers statistics about it;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_info(const char *string, size_t length,
+            utf8chk_flag_t flags, const char **error_at, size_t *error_len,
+            utf8chk_text_info_t *info) {
+    const unsigned char *p = (const unsigned char *)string, *end;
+    int null_terminated = length == UTF8CHK_CSTRING;
+    /* a surrogate pair only counts as one code point if they are paired.
+       the low surrogate may be overlong if overlong sequences are allowed. */
+    int count_lows = !(flags & UTF8CHK_CHECK_SURROGATES)
+                        || (flags & UTF8CHK_BAN_SURROGATES) ? 0
+                   : flags & (UTF8CHK_BAN_OVERLONG
+                              | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL) ? 1
+                   : UTF8CHK_TALLY_OVERLONG_LOWS;
+    utf8chk_tally_t tally = { 0, 0, 0, 0, 0, 0, 0 };
+    /* where the line of the error pointer starts,
+       and the code points before it. */
+    const unsigned char *line = p;
+    size_t line_code_points = 0;
+    utf8chk_error_t err = UTF8CHK_OK;
+    const char *at;
+    size_t len = 0;
+
+    /* a null-terminated string has the same errors as its bytes before the
+       terminator, which the blocks below need to know the end of. */
+    if (null_terminated)
+        length = utf8chk_strlen(string);
+    end = p + length;
+
+    while (p != end) {
+        size_t block = (size_t)(end - p) < UTF8CHK_INFO_BLOCK
+                     ? (size_t)(end - p) : UTF8CHK_INFO_BLOCK;
+        const unsigned char *stop = p + block;
+        size_t skip = utf8chk_valid_prefix(p, block, flags), newlines;
+
+        if (skip < block) {
+            err = utf8chk((const char *)p + skip, block - skip, flags,
+                          &at, &len);
+            if (err)
+                stop = (const unsigned char *)at;
+            switch (err) {
+            case UTF8CHK_ERR_TRUNC:
+            case UTF8CHK_ERR_TRUNC2:
+            case UTF8CHK_ERR_TRUNC3:
+            case UTF8CHK_ERR_SURROGATE_TRUNC:
+            case UTF8CHK_ERR_SURROGATE_TRUNC2:
+            case UTF8CHK_ERR_SURROGATE_TRUNC3:
+                /* the block may have cut the sequence (or surrogate pair)
+                   short, in which case it is left for the next block. */
+                if (p + block != end)
+                    err = UTF8CHK_OK, len = 0;
+                else if (null_terminated) {
+                    /* the terminator is where a continuation byte was
+                       expected, which utf8chk tells apart. */
+                    err = utf8chk((const char *)stop, UTF8CHK_CSTRING,
+                                  flags, &at, &len);
+                    stop = (const unsigned char *)at;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        /* count the block while it is still in the cache. */
+        newlines = tally.newlines;
+        utf8chk_tally(p, (size_t)(stop - p), count_lows, &tally);
+        if (tally.newlines != newlines) {
+            /* count the code points on the line after the last line feed,
+               which are usually few, to know how many come before it. */
+            utf8chk_tally_t tail = { 0, 0, 0, 0, 0, 0, 0 };
+            line = stop;
+            while (line[-1] != '\n')
+                --line;
+            utf8chk_tally(line, (size_t)(stop - line), count_lows, &tail);
+            line_code_points = utf8chk_tally_code_points(&tally)
+                             - utf8chk_tally_code_points(&tail);
+        }
+
+        p = stop;
+        if (err) break;
+    }
+
+    if (info) {
+        info->code_points = utf8chk_tally_code_points(&tally);
+        /* as in utf8chk_decode32, a high surrogate left unpaired
+           by the error is not a code point. */
+        if (err && count_lows) {
+            utf8chk_state_t state;
+            utf8chk_state_at(&state, (const unsigned char *)string, p,
+                             flags);
+            if (state.expect_low_surrogate)
+                --info->code_points;
+        }
+        info->sequences[0] = tally.bytes - tally.cont - tally.lead2;
+        info->sequences[1] = tally.lead2 - tally.lead3;
+        info->sequences[2] = tally.lead3 - tally.lead4;
+        info->sequences[3] = tally.lead4;
+        info->newlines = tally.newlines;
+        info->line = tally.newlines + 1;
+        info->column = (size_t)(p - line) + 1;
+        info->code_point_column = info->code_points - line_code_points + 1;
+    }
+    UTF8CHK_RETURN_ERROR(err, p, len);
+}
+
+/* Validates the bytes of data from offset from up to offset to, where
+   validation can start at from as if from the start of a string, and to
+   is either another such point or end, the offset where the string to be
+   validated ends. Returns the same as utf8chk on the bytes from from to
+   end, if they are valid after to. */
+static utf8chk_error_t utf8chk_check_window(const char *data,
+            utf8chk_flag_t flags, size_t from, size_t to, size_t end,
+            const char **error_at, size_t *error_len) {
+    utf8chk_error_t err = utf8chk(data + from, to - from, flags,
+                                  error_at, error_len);
+    switch (err) {
+    case UTF8CHK_ERR_TRUNC:
+    case UTF8CHK_ERR_TRUNC2:
+    case UTF8CHK_ERR_TRUNC3:
+    case UTF8CHK_ERR_SURROGATE_TRUNC:
+    case UTF8CHK_ERR_SURROGATE_TRUNC2:
+    case UTF8CHK_ERR_SURROGATE_TRUNC3:
+        /* a sequence was cut short by to rather than by end. to is at the
+           start of a sequence, so there is an error before it, which the
+           next few bytes tell apart. */
+        if (to != end)
+            err = utf8chk(data + from, (end - to < 4 ? end : to + 4) - from,
+                          flags, error_at, error_len);
+        break;
+    default:
+        break;
+    }
+    return err;
+}
+
+/* an index entry holds the offset of the point where validation can start
+   in its block, or UTF8CHK_INDEX_NONE if there is none near the start of
+   the block, and UTF8CHK_INDEX_CLEAN if the bytes from there to the
+   point in the next block (or to the end of the buffer) are valid. */
+#define UTF8CHK_INDEX_OFFSET 0x07U
+#define UTF8CHK_INDEX_NONE 0x07U
+#define UTF8CHK_INDEX_CLEAN 0x08U
+
+/* Returns how many bytes there are from at to the first point after it
+   where validation can start as if from the start of a string: the start
+   of a sequence, and with UTF8CHK_CHECK_SURROGATES, not right after a
+   high surrogate. Returns UTF8CHK_INDEX_NONE if there is no such point
+   among the first few bytes. */
+static unsigned utf8chk_index_start(const unsigned char *data, size_t at,
+                                    size_t length, utf8chk_flag_t flags) {
+    unsigned skip = 0, n;
+    utf8chk_state_t state;
+    utf8chk_uchar_t u;
+
+    /* no sequence has more than three continuation bytes. */
+    while (at + skip < length && (data[at + skip] & 0xC0U) == 0x80U)
+        if (++skip > 3)
+            return UTF8CHK_INDEX_NONE;
+    at += skip;
+    utf8chk_state_at(&state, data, data + at, flags);
+    if (state.expect_low_surrogate) {
+        /* start after the low surrogate that pairs with it, if any,
+           which decodes into the code point of the pair. */
+        if (at == length || utf8chk_decode(&state, data + at, length - at,
+                                           0, flags, &n, &u, NULL, NULL)
+                || u == UTF8CHK_NO_OUTPUT || u <= 0xFFFFU
+                || utf8chk_beyond_bmp(data + at)
+                || skip + n >= UTF8CHK_INDEX_NONE
+                || (length - at > n && (data[at + n] & 0xC0U) == 0x80U))
+            return UTF8CHK_INDEX_NONE;
+        skip += n;
+    }
+    return skip;
+}
+
+/** Builds an index over a buffer; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+void utf8chk_index_build(utf8chk_index_t *index, const char *data,
+            size_t length, utf8chk_flag_t flags, unsigned char *blocks) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t count = UTF8CHK_INDEX_BLOCKS(length), k;
+    unsigned start = count
+                ? utf8chk_index_start(p, 0, length, flags) : 0, next;
+
+    index->data = data;
+    index->length = length;
+    index->flags = flags;
+    index->blocks = blocks;
+    index->dirty = 0;
+
+    for (k = 0; k < count; ++k) {
+        size_t from = k * UTF8CHK_INDEX_BLOCK + start, to = length;
+
+        next = k + 1 < count ? utf8chk_index_start(p,
+                    (k + 1) * UTF8CHK_INDEX_BLOCK, length, flags) : 0;
+        if (k + 1 < count)
+            to = (k + 1) * UTF8CHK_INDEX_BLOCK + next;
+        blocks[k] = (unsigned char)start;
+        if (start != UTF8CHK_INDEX_NONE && next != UTF8CHK_INDEX_NONE
+                && !utf8chk(data + from, to - from, flags, NULL, NULL))
+            blocks[k] |= UTF8CHK_INDEX_CLEAN;
+        else
+            ++index->dirty;
+        start = next;
+    }
+}
+
+/* Returns the offset in the buffer of the point recorded for block k of
+   an index, or (size_t)-1 if there is none. */
+static size_t utf8chk_index_point(const utf8chk_index_t *index, size_t k) {
+    unsigned start = index->blocks[k] & UTF8CHK_INDEX_OFFSET;
+    return start == UTF8CHK_INDEX_NONE
+         ? (size_t)-1 : k * UTF8CHK_INDEX_BLOCK + start;
+}
+
+/** Validates a slice of the buffer of an index;
+    see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_index_check(const utf8chk_index_t *index,
+            size_t begin, size_t end, const char **error_at,
+            size_t *error_len) {
+    size_t count = UTF8CHK_INDEX_BLOCKS(index->length);
+    size_t k = begin / UTF8CHK_INDEX_BLOCK, from = begin, point = 0;
+    utf8chk_error_t err;
+
+    for (;;) {
+        /* validate up to the next point, from which validation continues
+           as if the slice started there. */
+        while (k < count && ((point = utf8chk_index_point(index, k))
+                                == (size_t)-1 || point <= from))
+            ++k;
+        if (k == count || point > end)
+            break;
+        err = utf8chk_check_window(index->data, index->flags, from, point,
+                                   end, error_at, error_len);
+        if (err)
+            return err;
+
+        /* skip the clean blocks, which are valid up to the next point. */
+        if (!index->dirty) {
+            k = end / UTF8CHK_INDEX_BLOCK;
+            if (k == count || utf8chk_index_point(index, k) > end)
+                --k;
+        } else {
+            while ((index->blocks[k] & UTF8CHK_INDEX_CLEAN) && k + 1 < count
+                    && utf8chk_index_point(index, k + 1) <= end)
+                ++k;
+        }
+        from = utf8chk_index_point(index, k++);
+    }
+    return utf8chk_check_window(index->data, index->flags, from, end, end,
+                                error_at, error_len);
+}
+
+/** Validates a buffer after an edit; see the declaration above. */
+#ifdef UTF8CHK_STATIC
+static
+#endif
+utf8chk_error_t utf8chk_revalidate(const char *data, size_t length,
+            utf8chk_flag_t flags, size_t edit_begin, size_t edit_end,
+            const char **error_at, size_t *error_len) {
+    const unsigned char *p = (const unsigned char *)data;
+    int surrogates = (flags & UTF8CHK_CHECK_SURROGATES) != 0;
+    size_t from = edit_begin, to = edit_end;
+    utf8chk_state_t state;
+    utf8chk_error_t err;
+
+    /* the bytes before from are the same whole sequences as before the
+       edit, which were valid, so validation can start at from unless it
+       would be in the middle of a surrogate pair. */
+    if (from) {
+        while (--from && edit_begin - from < 4 && (p[from] & 0xC0U) == 0x80U)
+            ;
+        if ((p[from] & 0xC0U) == 0x80U)
+            from = 0;
+    }
+    utf8chk_state_at(&state, p, p + from, flags);
+    if (state.expect_low_surrogate)
+        from -= state.n_prev;
+
+    /* the bytes after to are also as they were, apart from the rest of
+       a sequence cut by the edit. From the first whole sequence on, they
+       are valid as before the edit, as long as whether a high surrogate
+       comes right before it is the same; if it is a surrogate or follows
+       one, validate it too. */
+    while (to < length && to - edit_end < 3 && (p[to] & 0xC0U) == 0x80U)
+        ++to;
+    if (to < length && (p[to] & 0xC0U) == 0x80U)
+        to = length;
+    while (surrogates && to < length) {
+        /* the sequence is a surrogate if decoding it leaves a low
+           surrogate pending (a high one) or fails (a low one that
+           does not follow a high one). */
+        unsigned n;
+        utf8chk_uchar_t u;
+        int after_high;
+        utf8chk_state_at(&state, p, p + to, flags);
+        after_high = state.expect_low_surrogate;
+        if (!after_high && !utf8chk_decode(&state, p + to, length - to, 0,
+                                           flags, &n, &u, NULL, NULL)
+                && !state.expect_low_surrogate)
+            break;
+        to += p[to] >= 0xC0U && p[to] < 0xF8U
+            ? utf8chk_sequence_length(p[to]) : 1;
+        if (to > length)
+            to = length;
+    }
+
+    err = utf8chk_check_window(data, flags, from, to, length,
+                               error_at, error_len);
+    if (!err)
+        UTF8CHK_SET_ERROR_AT_LEN(data + length, 0);
+    return err;
 }
 
 #endif /* UTF8CHK_IMPL */
@@ -0,0 +1,231 @@
+/*******************************************************************************
+*                                                                              *
+*   UTF8CHK -- PORTABLE, SINGLE-HEADER, UTF-8 VALIDATION LIBRARY FOR C         *
+*   C++20 WRAPPER WITH COMPILE-TIME VALIDATION                                 *
+*                                                                              *
+*   THIS LIBRARY IS DUAL-LICENSED UNDER THE UNLICENSE PUBLIC-DOMAIN            *
+*   EQUIVALENT LICENSE AND THE MIT LICENSE.                                    *
+*                                                                              *
+*******************************************************************************/
+
+/* To use this wrapper, include it instead of utf8chk.h; the same rules
+   about UTF8CHK_STATIC and UTF8CHK_IMPL apply, and the implementation may
+   be compiled as either C or C++.
+
+   utf8chkpp::validate<Flags>(text) validates a std::string_view or
+   std::u8string_view with the flags given as a template argument, so that
+   the checks the flags do not ask for are compiled out:
+
+    static_assert(utf8chkpp::validate<UTF8CHK_UTF8>("caf\xc3\xa9").ok());
+
+    auto result = utf8chkpp::validate<UTF8CHK_MUTF8>(text);
+    if (!result.ok())
+        report(result.error, result.offset, result.length);
+
+   In a constant expression, the string is validated by a constexpr copy
+   of the validation loop. Otherwise, the call goes to the C engine: to the
+   entry point specialized for the flags if they are a preset, or else to
+   utf8chk. Either way, the result is exactly what utf8chk would return. */
+
+#ifndef UTF8CHK_HPP
+#define UTF8CHK_HPP
+
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+#include "utf8chk.h"
+
+namespace utf8chkpp {
+
+/* The result of a validation. */
+struct result {
+    /* UTF8CHK_OK, or the first error found. */
+    utf8chk_error_t error;
+    /* the index of the error pointer (see utf8chk_error) in the string.
+       the length of the string if there is no error. */
+    std::size_t offset;
+    /* the error length (see utf8chk_error). */
+    std::size_t length;
+
+    /* whether the string is valid. */
+    constexpr bool ok() const noexcept { return error == UTF8CHK_OK; }
+
+    friend constexpr bool operator==(const result &,
+                                     const result &) = default;
+};
+
+namespace detail {
+
+/* picks err, err2 or err3 for a count of 1, 2 or 3,
+   like UTF8CHK_RETURN_ERROR_N. */
+constexpr utf8chk_error_t pick(std::size_t count, utf8chk_error_t err,
+                               utf8chk_error_t err2,
+                               utf8chk_error_t err3) noexcept {
+    return count == 2 ? err2 : count == 3 ? err3 : err;
+}
+
+/* the validation loop of utf8chk for a string with an explicit length,
+   written to be evaluated at compile time. */
+template <unsigned Flags, typename Char>
+constexpr result check(const Char *string, std::size_t length) noexcept {
+    /* index of the sequence being read. */
+    std::size_t at = 0;
+    /* length of the last sequence. */
+    std::size_t n_prev = 0;
+    /* cached codepoint from high surrogate. */
+    char32_t u_cache = 0;
+    /* whether to allow low surrogates. */
+    bool expect_low_surrogate = false;
+
+    while (at < length) {
+        unsigned char c = static_cast<unsigned char>(string[at]);
+        std::size_t left = length - at, n;
+        char32_t u, u_min;
+
+        if (c < 0x80U) {
+            if (!c && (Flags & UTF8CHK_BAN_NULL_BYTE))
+                return { UTF8CHK_ERR_NULL_BYTE, at, 1 };
+            expect_low_surrogate = false;
+            n_prev = 1;
+            ++at;
+            continue;
+        } else if (c < 0xC0U) {
+            return { UTF8CHK_ERR_UNEXPECTED_CONT, at, 1 };
+        } else if (c < 0xE0U) {
+            n = 2, u = c & 0x1FU, u_min = 0x0080;
+        } else if (c < 0xF0U) {
+            n = 3, u = c & 0x0FU, u_min = 0x0800;
+        } else if (c < 0xF8U) {
+            n = 4, u = c & 0x07U, u_min = 0x10000;
+        } else {
+            return { UTF8CHK_ERR_INVALID_START_BYTE, at, 1 };
+        }
+
+        if (left < n) {
+            if (expect_low_surrogate)
+                return { pick(n - left, UTF8CHK_ERR_SURROGATE_TRUNC,
+                              UTF8CHK_ERR_SURROGATE_TRUNC2,
+                              UTF8CHK_ERR_SURROGATE_TRUNC3),
+                         at - n_prev, n_prev };
+            return { pick(n - left, UTF8CHK_ERR_TRUNC, UTF8CHK_ERR_TRUNC2,
+                          UTF8CHK_ERR_TRUNC3), at, left };
+        }
+
+        for (std::size_t i = 1; i < n; ++i) {
+            c = static_cast<unsigned char>(string[at + i]);
+            if ((c & 0xC0U) != 0x80U)
+                return { pick(n - i, UTF8CHK_ERR_EXPECTED_CONT,
+                              UTF8CHK_ERR_EXPECTED_CONT2,
+                              UTF8CHK_ERR_EXPECTED_CONT3), at, i };
+            u = (u << 6) | (c & 0x3FU);
+        }
+
+        if (u > 0x10FFFF)
+            return { UTF8CHK_ERR_RANGE, at, n };
+
+        if constexpr ((Flags & (UTF8CHK_BAN_OVERLONG
+                              | UTF8CHK_BAN_OVERLONG_EXCEPT_NULL)) != 0) {
+            if (u < u_min && ((Flags & UTF8CHK_BAN_OVERLONG) || u || n != 2))
+                return { UTF8CHK_ERR_OVERLONG, at, n };
+        }
+
+        if (0xD800 <= u && u <= 0xDFFF) {
+            bool is_low = (u & 0x400) != 0;
+
+            if constexpr ((Flags & UTF8CHK_BAN_SURROGATES) != 0) {
+                return { UTF8CHK_ERR_SURROGATE, at, n };
+            } else if constexpr ((Flags & UTF8CHK_CHECK_SURROGATES) != 0) {
+                if (is_low && !expect_low_surrogate)
+                    return { UTF8CHK_ERR_SURROGATE_LOW, at, n };
+                else if (!is_low && expect_low_surrogate)
+                    return { UTF8CHK_ERR_SURROGATE_HIGH, at, n };
+
+                expect_low_surrogate = !is_low;
+                if (!is_low) {
+                    u_cache = 0x10000 + ((u & 0x3FF) << 10);
+                    n_prev = n;
+                    at += n;
+                    continue;
+                }
+                u = u_cache | (u & 0x3FF);
+            }
+        } else {
+            expect_low_surrogate = false;
+        }
+
+        if constexpr ((Flags & UTF8CHK_BAN_NONCHARACTERS) != 0) {
+            if ((u & 0xFFFE) == 0xFFFE || (0xFDD0 <= u && u <= 0xFDEF))
+                return { UTF8CHK_ERR_NONCHARACTER, at, n };
+        }
+
+        n_prev = n;
+        at += n;
+    }
+
+    if ((Flags & UTF8CHK_CHECK_SURROGATES) && expect_low_surrogate)
+        return { UTF8CHK_ERR_SURROGATE_TRUNC, at - n_prev, n_prev };
+    return { UTF8CHK_OK, at, 0 };
+}
+
+/* calls the C engine, specialized for the flags if there is a version
+   for them. */
+template <unsigned Flags>
+inline result run(const char *string, std::size_t length) noexcept {
+    const char *error_at;
+    std::size_t error_len;
+    utf8chk_error_t err;
+
+    if (!length)
+        return { UTF8CHK_OK, 0, 0 };
+    if constexpr (Flags == UTF8CHK_LAX)
+        err = utf8chk_lax(string, length, &error_at, &error_len);
+    else if constexpr (Flags == UTF8CHK_UTF8)
+        err = utf8chk_utf8(string, length, &error_at, &error_len);
+    else if constexpr (Flags == UTF8CHK_MUTF8)
+        err = utf8chk_mutf8(string, length, &error_at, &error_len);
+    else if constexpr (Flags == UTF8CHK_CESU8)
+        err = utf8chk_cesu8(string, length, &error_at, &error_len);
+    else if constexpr (Flags == UTF8CHK_WTF8)
+        err = utf8chk_wtf8(string, length, &error_at, &error_len);
+    else if constexpr (Flags == UTF8CHK_STRICT)
+        err = utf8chk_strict(string, length, &error_at, &error_len);
+    else
+        err = ::utf8chk(string, length, static_cast<utf8chk_flag_t>(Flags),
+                        &error_at, &error_len);
+    return { err, static_cast<std::size_t>(error_at - string), error_len };
+}
+
+} /* namespace detail */
+
+/* Validates the string with the given flags, which default to
+   UTF8CHK_UTF8. Null bytes are part of the string, as with an explicit
+   length in utf8chk. */
+template <unsigned Flags = UTF8CHK_UTF8>
+constexpr result validate(std::string_view string) noexcept {
+    if (std::is_constant_evaluated())
+        return detail::check<Flags>(string.data(), string.size());
+    return detail::run<Flags>(string.data(), string.size());
+}
+
+template <unsigned Flags = UTF8CHK_UTF8>
+constexpr result validate(std::u8string_view string) noexcept {
+    if (std::is_constant_evaluated())
+        return detail::check<Flags>(string.data(), string.size());
+    return detail::run<Flags>(reinterpret_cast<const char *>(string.data()),
+                              string.size());
+}
+
+/* Returns whether every string in the range is valid with the given flags,
+   such as for a static_assert over a table of literals. */
+template <unsigned Flags = UTF8CHK_UTF8, typename Range>
+constexpr bool all_valid(const Range &strings) noexcept {
+    for (const auto &string : strings)
+        if (!utf8chkpp::validate<Flags>(string).ok())
+            return false;
+    return true;
+}
+
+} /* namespace utf8chkpp */
+
+#endif /* UTF8CHK_HPP */
@@ -0,0 +1,596 @@
+/* utf8chk benchmark.
+
+   cc -O2 -pthread -DUTF8CHK_THREADS utf8chk_bench.c -o utf8chk_bench
+   ./utf8chk_bench [-csv] [megabytes] [max threads]
+
+   Generates a set of deterministic corpora, each the given number of
+   megabytes (32 by default), and measures the throughput of utf8chk on
+   every corpus under every preset, both with an explicit length and as
+   a null-terminated string, as well as that of utf8chk_valid,
+   utf8chk_info and utf8chk_copy, the last next to memcpy followed by
+   utf8chk on the copy. Then measures mixed text cut into short strings
+   of 10 to 200 bytes, with one utf8chk call per string, with
+   utf8chk_batch and as a column with utf8chk_column, and how
+   utf8chk_parallel scales from one thread up to the given number of
+   threads (by default, the number of online processors) on the same
+   text as a whole.
+
+   Build with -DUTF8CHK_DFA or -DUTF8CHK_SIMD to measure those engines
+   instead of the scalar loop. With -csv, the results are printed as
+   comma-separated values for regression tracking. Cycles per byte are
+   only measured on x86, where they are counted by the time stamp
+   counter, which runs at a fixed rate rather than the current clock
+   speed of the core. */
+
+#define _POSIX_C_SOURCE 200112L
+#define UTF8CHK_IMPL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utf8chk.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_CYCLES() ((unsigned long long)__rdtsc())
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+#define BENCH_RUNS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* the corpora are generated with this linear congruential generator, so
+   that every run measures the same bytes. */
+static unsigned long next_random(unsigned long *seed) {
+    *seed = *seed * 1103515245UL + 12345UL;
+    return (*seed >> 16) & 0x7FFFUL;
+}
+
+/* fills the buffer with words from the given list, chosen at random,
+   and pads the end with spaces. */
+static void fill_words(char *buffer, size_t size,
+                       const char *const *words, size_t count) {
+    unsigned long seed = 1;
+    size_t at = 0;
+
+    while (at < size) {
+        const char *word = words[next_random(&seed) % count];
+        size_t length = strlen(word);
+        if (length > size - at) {
+            memset(buffer + at, ' ', size - at);
+            break;
+        }
+        memcpy(buffer + at, word, length);
+        at += length;
+    }
+}
+
+static void fill_ascii(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ",
+        "dog. ", "\n"
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+static void fill_latin(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "\xc3\xa9t\xc3\xa9 ", "gar\xc3\xa7on ", "stra\xc3\x9f" "e ",
+        "ni\xc3\xb1o ", "na\xc3\xafve ", "le ", "und ", "\xc3\xa0 ", "\n"
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+static void fill_cjk(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", "\xe4\xb8\xad\xe6\x96\x87",
+        "\xe3\x81\x93\xe3\x82\x93\xe3\x81\xab\xe3\x81\xa1\xe3\x81\xaf",
+        "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4", "\xe3\x80\x82"
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+/* emoji with the odd joiner, variation selector and bit of ASCII. */
+static void fill_emoji(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "\xf0\x9f\x98\x83", "\xf0\x9f\x91\x8d", "\xf0\x9f\x8e\x89",
+        "\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x92\xbb",
+        "\xe2\x9d\xa4\xef\xb8\x8f", "\xf0\x9f\x87\xab\xf0\x9f\x87\xae",
+        "ok ", " "
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+/* MUTF-8: supplementary characters as surrogate pairs, and U+0000 as
+   C0 80. only valid under the lax and MUTF-8 presets. */
+static void fill_mutf8(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "\xed\xa0\xbd\xed\xb8\x83", "\xed\xa0\xbc\xed\xbe\x89",
+        "\xc0\x80", "name ", "\xc3\xa9t\xc3\xa9 ",
+        "\xe6\x97\xa5\xe6\x9c\xac "
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+/* fills the buffer with valid UTF-8 text: mostly ASCII, with some
+   two-, three- and four-byte sequences mixed in. */
+static void fill_text(char *buffer, size_t size) {
+    static const char *const words[] = {
+        "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ",
+        "dog. ", "\xc3\xa9t\xc3\xa9 ", "\xd0\xbc\xd0\xb8\xd1\x80 ",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e ", "\xf0\x9f\x98\x83 ",
+        "\n"
+    };
+    fill_words(buffer, size, words, sizeof(words) / sizeof(words[0]));
+}
+
+/* random bytes, which are mostly errors. zero is left out, so that
+   null-terminated runs see the whole buffer. */
+static void fill_random(char *buffer, size_t size) {
+    unsigned long seed = 1;
+    size_t at;
+    for (at = 0; at < size; ++at) {
+        unsigned char c = (unsigned char)next_random(&seed);
+        buffer[at] = (char)(c ? c : 1);
+    }
+}
+
+/* mixed text with an invalid byte at the given percentage of the way. */
+static void fill_error(char *buffer, size_t size, unsigned percent) {
+    fill_text(buffer, size);
+    buffer[size / 100 * percent] = (char)0xFF;
+}
+
+static void fill_error0(char *buffer, size_t size) {
+    fill_error(buffer, size, 0);
+}
+
+static void fill_error50(char *buffer, size_t size) {
+    fill_error(buffer, size, 50);
+}
+
+static void fill_error99(char *buffer, size_t size) {
+    fill_error(buffer, size, 99);
+}
+
+static const struct corpus {
+    const char *name;
+    void (*fill)(char *buffer, size_t size);
+    /* whether to carry on after each error. otherwise utf8chk stops
+       at the first error, which is what the error corpora measure. */
+    int resume;
+} corpora[] = {
+    { "ascii", fill_ascii, 0 },
+    { "latin", fill_latin, 0 },
+    { "cjk", fill_cjk, 0 },
+    { "emoji", fill_emoji, 0 },
+    { "mutf8", fill_mutf8, 0 },
+    { "random", fill_random, 1 },
+    { "error0", fill_error0, 0 },
+    { "error50", fill_error50, 0 },
+    { "error99", fill_error99, 0 }
+};
+
+struct result {
+    /* best time of BENCH_RUNS runs, in seconds and in cycles. */
+    double seconds;
+    unsigned long long cycles;
+    /* bytes examined, up to and including the first error unless
+       resuming, and the number of errors found. */
+    size_t checked;
+    size_t errors;
+};
+
+/* runs utf8chk over the buffer of the given size, which must be
+   followed by a null terminator, BENCH_RUNS times. */
+static struct result time_utf8chk(const char *buffer, size_t size,
+                                  utf8chk_flag_t flags, int cstring,
+                                  int resume) {
+    struct result best = { 0, 0, 0, 0 };
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        const char *at = buffer, *end = buffer + size;
+        size_t errors = 0;
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+
+        while (at != end) {
+            const char *error_at;
+            size_t error_len;
+            if (!utf8chk(at, cstring ? UTF8CHK_CSTRING : (size_t)(end - at),
+                         flags, &error_at, &error_len)) {
+                at = end;
+                break;
+            }
+            ++errors;
+            at = error_at + error_len;
+            if (!resume || !error_len) break;
+        }
+
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+            best.checked = (size_t)(at - buffer);
+            best.errors = errors;
+        }
+    }
+    return best;
+}
+
+/* runs utf8chk_valid over the buffer BENCH_RUNS times. the bytes up to
+   the first error are found with utf8chk beforehand. */
+static struct result time_valid(const char *buffer, size_t size,
+                                utf8chk_flag_t flags) {
+    struct result best = { 0, 0, 0, 0 };
+    const char *error_at;
+    size_t error_len;
+    int run;
+
+    best.errors = utf8chk(buffer, size, flags, &error_at, &error_len) != 0;
+    best.checked = (size_t)(error_at - buffer) + error_len;
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+        if (!utf8chk_valid(buffer, size, flags) != (best.errors != 0)) {
+            fputs("utf8chk_valid disagrees with utf8chk\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+        }
+    }
+    return best;
+}
+
+static struct result time_info(const char *buffer, size_t size,
+                               utf8chk_flag_t flags) {
+    struct result best = { 0, 0, 0, 0 };
+    const char *error_at, *info_at;
+    size_t error_len;
+    int run;
+
+    best.errors = utf8chk(buffer, size, flags, &error_at, &error_len) != 0;
+    best.checked = (size_t)(error_at - buffer) + error_len;
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        utf8chk_text_info_t info;
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+        utf8chk_info(buffer, size, flags, &info_at, NULL, &info);
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (info_at != error_at) {
+            fputs("utf8chk_info disagrees with utf8chk\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+        }
+    }
+    return best;
+}
+
+/* copies the buffer into copy BENCH_RUNS times, validating it with
+   utf8chk_copy if fused is set, or else with utf8chk after memcpy. */
+static struct result time_copy(const char *buffer, size_t size,
+                               utf8chk_flag_t flags, char *copy, int fused) {
+    struct result best = { 0, 0, 0, 0 };
+    const char *error_at;
+    size_t error_len, copied_at;
+    int run;
+
+    best.errors = utf8chk(buffer, size, flags, &error_at, &error_len) != 0;
+    best.checked = (size_t)(error_at - buffer) + error_len;
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+        if (fused) {
+            utf8chk_copy(copy, buffer, size, flags, &copied_at, NULL);
+        } else {
+            const char *copy_at;
+            memcpy(copy, buffer, size);
+            utf8chk(copy, size, flags, &copy_at, NULL);
+            copied_at = (size_t)(copy_at - copy);
+        }
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (copied_at != (size_t)(error_at - buffer)) {
+            fputs("utf8chk_copy disagrees with utf8chk\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+        }
+    }
+    return best;
+}
+
+/* cuts the buffer into strings of 10 to 200 bytes, like header values,
+   each ending at a sequence boundary. returns the number of strings. */
+static size_t cut_strings(const char *buffer, size_t size,
+                          const char **strings, size_t *lengths) {
+    unsigned long seed = 1;
+    size_t at = 0, count = 0;
+
+    while (at < size) {
+        size_t length = 10 + next_random(&seed) % 191;
+        if (length > size - at) length = size - at;
+        while (at + length < size
+                && ((unsigned char)buffer[at + length] & 0xC0) == 0x80)
+            ++length;
+        strings[count] = buffer + at;
+        lengths[count++] = length;
+        at += length;
+    }
+    return count;
+}
+
+/* validates the strings BENCH_RUNS times, either with one utf8chk call
+   per string or with utf8chk_batch. */
+static struct result time_strings(const char *const *strings,
+                                  const size_t *lengths, size_t count,
+                                  utf8chk_flag_t flags, int batch) {
+    struct result best = { 0, 0, 0, 0 };
+    size_t i;
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        size_t errors = 0;
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+
+        if (batch)
+            errors = utf8chk_batch(strings, lengths, count, flags, NULL);
+        else
+            for (i = 0; i < count && !errors; ++i)
+                errors = utf8chk(strings[i], lengths[i], flags,
+                                 NULL, NULL) != 0;
+
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+            best.errors = errors;
+        }
+    }
+    for (i = 0; i < count; ++i)
+        best.checked += lengths[i];
+    return best;
+}
+
+/* validates the strings BENCH_RUNS times as a column of offsets into
+   the buffer with utf8chk_column. */
+static struct result time_column(const char *buffer,
+                                 const utf8chk_offset_t *offsets,
+                                 size_t count, utf8chk_flag_t flags) {
+    struct result best = { 0, 0, 0, 0 };
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        double start = now(), elapsed;
+        unsigned long long start_cycles = BENCH_CYCLES(), cycles;
+        size_t bad = utf8chk_column(buffer, offsets, count, flags, NULL);
+
+        cycles = BENCH_CYCLES() - start_cycles;
+        elapsed = now() - start;
+        if (!run || elapsed < best.seconds) {
+            best.seconds = elapsed;
+            best.cycles = cycles;
+            best.errors = bad != count;
+        }
+    }
+    best.checked = (size_t)(offsets[count] - offsets[0]);
+    return best;
+}
+
+/* returns the best time of BENCH_RUNS runs in seconds. */
+static double time_parallel(const char *buffer, size_t size,
+                            unsigned threads) {
+    double best = 0;
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        double start = now(), elapsed;
+        if (utf8chk_parallel(buffer, size, UTF8CHK_UTF8, NULL, NULL,
+                             threads, NULL, NULL)) {
+            fputs("benchmark text is not valid\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        elapsed = now() - start;
+        if (!run || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+static const char *engine_name(void) {
+#if defined(UTF8CHK_SIMD)
+    return utf8chk_simd_name();
+#elif defined(UTF8CHK_DFA)
+    return "dfa";
+#else
+    return "scalar";
+#endif
+}
+
+static void print_result(int csv, const char *corpus, const char *preset,
+                         const char *mode, unsigned threads,
+                         const struct result *result) {
+    double gbps = result->seconds > 0
+                ? (double)result->checked / result->seconds / 1e9 : 0;
+    double cpb = result->checked
+               ? (double)result->cycles / (double)result->checked : 0;
+
+    if (csv) {
+        printf("%s,%s,%s,%s,%u,%lu,%.9f,%.4f,", engine_name(), corpus,
+               preset, mode, threads, (unsigned long)result->checked,
+               result->seconds, gbps);
+        if (result->cycles) printf("%.4f", cpb);
+        printf(",%lu\n", (unsigned long)result->errors);
+    } else {
+        printf("%8s %6s %7s %10.2f %10.2f ", corpus, preset, mode,
+               (double)result->checked / (1 << 20), gbps);
+        if (result->cycles)
+            printf("%10.3f", cpb);
+        else
+            printf("%10s", "-");
+        printf(" %8lu\n", (unsigned long)result->errors);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const struct {
+        const char *name;
+        utf8chk_flag_t flags;
+    } presets[] = {
+        { "lax", UTF8CHK_LAX },
+        { "utf8", UTF8CHK_UTF8 },
+        { "mutf8", UTF8CHK_MUTF8 },
+        { "cesu8", UTF8CHK_CESU8 },
+        { "wtf8", UTF8CHK_WTF8 },
+        { "strict", UTF8CHK_STRICT }
+    };
+    int csv = argc > 1 && !strcmp(argv[1], "-csv");
+    size_t megabytes = argc > 1 + csv ? (size_t)atol(argv[1 + csv]) : 32;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = argc > 2 + csv ? (unsigned)atoi(argv[2 + csv])
+                         : online > 0 ? (unsigned)online : 1;
+    size_t size = megabytes << 20;
+    double single = 0;
+    unsigned threads;
+    size_t i, j, count;
+    int cstring, batch;
+    char *buffer, *copy;
+    const char **strings;
+    size_t *lengths;
+    utf8chk_offset_t *offsets;
+
+    if (!size || !max_threads) {
+        fputs("usage: utf8chk_bench [-csv] [megabytes] [max threads]\n",
+              stderr);
+        return EXIT_FAILURE;
+    }
+    buffer = malloc(size + 1);
+    copy = malloc(size);
+    if (!buffer || !copy) {
+        fputs("out of memory\n", stderr);
+        return EXIT_FAILURE;
+    }
+    buffer[size] = 0;
+
+    if (csv)
+        puts("engine,corpus,flags,mode,threads,bytes,seconds,gb_per_s,"
+             "cycles_per_byte,errors");
+    else
+        printf("utf8chk (%s), %lu MiB\n%8s %6s %7s %10s %10s %10s %8s\n",
+               engine_name(), (unsigned long)megabytes, "corpus", "flags",
+               "mode", "MiB", "GB/s", "cycles/B", "errors");
+
+    for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+        corpora[i].fill(buffer, size);
+        for (j = 0; j < sizeof(presets) / sizeof(presets[0]); ++j) {
+            for (cstring = 0; cstring <= 1; ++cstring) {
+                struct result result = time_utf8chk(buffer, size,
+                        presets[j].flags, cstring, corpora[i].resume);
+                print_result(csv, corpora[i].name, presets[j].name,
+                             cstring ? "cstring" : "length", 1, &result);
+            }
+            if (!corpora[i].resume) {
+                struct result result = time_valid(buffer, size,
+                                                  presets[j].flags);
+                print_result(csv, corpora[i].name, presets[j].name,
+                             "valid", 1, &result);
+                result = time_info(buffer, size, presets[j].flags);
+                print_result(csv, corpora[i].name, presets[j].name,
+                             "info", 1, &result);
+                result = time_copy(buffer, size, presets[j].flags,
+                                   copy, 1);
+                print_result(csv, corpora[i].name, presets[j].name,
+                             "copy", 1, &result);
+                result = time_copy(buffer, size, presets[j].flags,
+                                   copy, 0);
+                print_result(csv, corpora[i].name, presets[j].name,
+                             "memcpy", 1, &result);
+            }
+        }
+    }
+
+    fill_text(buffer, size);
+
+    /* the same text as short strings, validated one call at a time and
+       as a batch. */
+    strings = malloc((size / 10 + 1) * sizeof(*strings));
+    lengths = malloc((size / 10 + 1) * sizeof(*lengths));
+    if (!strings || !lengths) {
+        fputs("out of memory\n", stderr);
+        return EXIT_FAILURE;
+    }
+    count = cut_strings(buffer, size, strings, lengths);
+    offsets = malloc((count + 1) * sizeof(*offsets));
+    if (!offsets) {
+        fputs("out of memory\n", stderr);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < count; ++i)
+        offsets[i] = (utf8chk_offset_t)(strings[i] - buffer);
+    offsets[count] = (utf8chk_offset_t)size;
+    for (j = 0; j < sizeof(presets) / sizeof(presets[0]); ++j) {
+        struct result result;
+        for (batch = 0; batch <= 1; ++batch) {
+            result = time_strings(strings, lengths, count,
+                                  presets[j].flags, batch);
+            print_result(csv, "short", presets[j].name,
+                         batch ? "batch" : "calls", 1, &result);
+        }
+        result = time_column(buffer, offsets, count, presets[j].flags);
+        print_result(csv, "short", presets[j].name, "column", 1, &result);
+    }
+    free(strings);
+    free(lengths);
+    free(offsets);
+
+    if (!csv) {
+#ifndef UTF8CHK_THREADS
+        puts("\nnote: built without UTF8CHK_THREADS, "
+             "chunks run on one thread");
+#else
+        putchar('\n');
+#endif
+        printf("utf8chk_parallel, %lu MiB of mixed text\n",
+               (unsigned long)megabytes);
+        printf("%8s %10s %10s\n", "threads", "GB/s", "speedup");
+    }
+    for (threads = 1; threads <= max_threads; ++threads) {
+        double elapsed = time_parallel(buffer, size, threads);
+        if (threads == 1) single = elapsed;
+        if (csv) {
+            struct result result = { 0, 0, 0, 0 };
+            result.seconds = elapsed;
+            result.checked = size;
+            print_result(csv, "text", "utf8", "parallel", threads, &result);
+        } else {
+            printf("%8u %10.2f %9.2fx\n", threads,
+                   (double)size / elapsed / 1e9, single / elapsed);
+        }
+    }
+
+    free(buffer);
+    free(copy);
+    return 0;
+}
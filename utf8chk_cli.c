@@ -0,0 +1,390 @@
+/* utf8chk command-line validator.
+
+   cc -O2 -pthread -DUTF8CHK_THREADS utf8chk_cli.c -o utf8chk
+   ./utf8chk [-a] [-q] [-p preset] [-j jobs] [file...]
+
+   Validates each file given on the command line, or the standard input
+   if there are none or the file is -, and prints every invalid file as
+
+       file:line:column: UTF8CHK_ERR_...
+
+   where line and column are 1-based and column counts bytes, and the
+   error name is the one returned by utf8chk_strerr. Regular files are
+   mapped into memory with mmap and validated in one call, and anything
+   else (pipes, terminals) is read a chunk at a time into a stream.
+
+   -p chooses the preset: lax, utf8 (the default), mutf8, cesu8, wtf8
+   or strict. -a reports every error in a mapped file instead of only
+   the first; the scan resumes after each error. -q prints nothing and
+   only sets the exit status. -j sets how many files are validated at
+   the same time (by default, the number of online processors); if there
+   is only one file, it is instead split over that many threads with
+   utf8chk_parallel. Without -DUTF8CHK_THREADS, the files are validated
+   one after another.
+
+   Exits with 0 if every file is valid, 1 if any is invalid and 2 if a
+   file could not be read or the command line was wrong. */
+
+#define _POSIX_C_SOURCE 200112L
+#define UTF8CHK_IMPL
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef UTF8CHK_THREADS
+#include <pthread.h>
+#endif
+
+#include "utf8chk.h"
+
+#define CLI_CHUNK 65536
+
+/* the exit statuses. */
+#define CLI_VALID 0
+#define CLI_INVALID 1
+#define CLI_FAILED 2
+
+/* the presets, spelled out because their constants cannot be used
+   in an initializer in C. */
+static const struct {
+    const char *name;
+    utf8chk_flag_t flags;
+} presets[] = {
+    { "lax", UTF8CHK_LAX },
+    { "utf8", (utf8chk_flag_t)(UTF8CHK_BAN_OVERLONG
+                             | UTF8CHK_BAN_SURROGATES) },
+    { "mutf8", (utf8chk_flag_t)(UTF8CHK_BAN_OVERLONG_EXCEPT_NULL
+                              | UTF8CHK_CHECK_SURROGATES) },
+    { "cesu8", (utf8chk_flag_t)(UTF8CHK_BAN_OVERLONG
+                              | UTF8CHK_CHECK_SURROGATES) },
+    { "wtf8", UTF8CHK_BAN_OVERLONG },
+    { "strict", UTF8CHK_STRICT }
+};
+
+/* what has been printed about a file, kept until the files before it
+   have been printed so that the output is in command-line order. */
+typedef struct report {
+    char *text;
+    size_t length;
+    size_t size;
+} report_t;
+
+/* a file to validate, and the results of doing so. */
+typedef struct file {
+    const char *path;
+    report_t out;
+    report_t err;
+    int status;
+} file_t;
+
+static utf8chk_flag_t flags;
+static int all_errors = 0;
+static int quiet = 0;
+static unsigned jobs = 1;
+
+static void report(report_t *report, const char *format, ...) {
+    va_list args;
+    int length;
+
+    for (;;) {
+        size_t room = report->size - report->length;
+        va_start(args, format);
+        length = vsnprintf(report->text + report->length, room,
+                           format, args);
+        va_end(args);
+        if (length < 0)
+            return;
+        if ((size_t)length < room) {
+            report->length += (size_t)length;
+            return;
+        } else {
+            size_t size = report->size ? report->size * 2 : 256;
+            char *text;
+            while (size - report->length <= (size_t)length)
+                size *= 2;
+            text = realloc(report->text, size);
+            if (!text)
+                return;
+            report->text = text;
+            report->size = size;
+        }
+    }
+}
+
+static void report_error(file_t *file, utf8chk_error_t err,
+                         unsigned long line, size_t column) {
+    file->status = CLI_INVALID;
+    if (!quiet)
+        report(&file->out, "%s:%lu:%lu: %s\n", file->path, line,
+               (unsigned long)column, utf8chk_strerr(err));
+}
+
+static void report_failure(file_t *file, const char *what) {
+    file->status = CLI_FAILED;
+    report(&file->err, "utf8chk: %s: %s: %s\n", file->path, what,
+           strerror(errno));
+}
+
+/* counts the lines in buffer[0..length) into *line, and moves *line_start
+   to just past the last one. */
+static void count_lines(const char *buffer, size_t length,
+                        unsigned long *line, size_t *line_start,
+                        size_t offset) {
+    const char *p = buffer, *end = buffer + length;
+    while ((p = memchr(p, '\n', end - p))) {
+        ++*line;
+        *line_start = offset + (size_t)(++p - buffer);
+    }
+}
+
+static void check_mapped(file_t *file, const char *data, size_t length) {
+    unsigned long line = 1;
+    size_t line_start = 0, counted = 0, offset = 0;
+
+    while (offset < length) {
+        const char *error_at;
+        size_t error_len, at;
+        utf8chk_error_t err;
+
+        if (jobs > 1)
+            err = utf8chk_parallel(data + offset, length - offset, flags,
+                                   &error_at, &error_len, jobs, NULL, NULL);
+        else
+            err = utf8chk(data + offset, length - offset, flags,
+                          &error_at, &error_len);
+        if (!err)
+            break;
+
+        at = (size_t)(error_at - data);
+        count_lines(data + counted, at - counted, &line, &line_start,
+                    counted);
+        counted = at;
+        report_error(file, err, line, at - line_start + 1);
+        if (!all_errors)
+            break;
+        offset = at + (error_len ? error_len : 1);
+    }
+}
+
+static void check_stream(file_t *file, int fd) {
+    utf8chk_stream_t stream;
+    utf8chk_error_t err = UTF8CHK_OK;
+    unsigned long line = 1;
+    size_t line_start = 0, fed = 0, error_at, error_len;
+    char *chunk = malloc(CLI_CHUNK);
+
+    if (!chunk) {
+        report_failure(file, "read");
+        return;
+    }
+    utf8chk_stream_init(&stream, flags);
+    for (;;) {
+        ssize_t got = read(fd, chunk, CLI_CHUNK);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            report_failure(file, "read");
+            free(chunk);
+            return;
+        }
+        if (!got)
+            break;
+        err = utf8chk_stream_feed(&stream, chunk, (size_t)got,
+                                  &error_at, &error_len);
+        if (err) {
+            /* the bytes kept over from the chunks before are part of
+               a sequence, so none of them is a newline. */
+            if (error_at > fed)
+                count_lines(chunk, error_at - fed, &line, &line_start, fed);
+            break;
+        }
+        count_lines(chunk, (size_t)got, &line, &line_start, fed);
+        fed += (size_t)got;
+    }
+    if (!err)
+        err = utf8chk_stream_finish(&stream, &error_at, &error_len);
+    if (err)
+        report_error(file, err, line, error_at - line_start + 1);
+    free(chunk);
+}
+
+static void check_file(file_t *file) {
+    struct stat st;
+    int fd;
+
+    if (!strcmp(file->path, "-")) {
+        file->path = "<stdin>";
+        check_stream(file, STDIN_FILENO);
+        return;
+    }
+
+    fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        report_failure(file, "open");
+        return;
+    }
+    if (fstat(fd, &st)) {
+        report_failure(file, "stat");
+    } else if (S_ISREG(st.st_mode)) {
+        size_t length = (size_t)st.st_size;
+        void *data = length ? mmap(NULL, length, PROT_READ, MAP_PRIVATE,
+                                   fd, 0)
+                            : NULL;
+        if (data == MAP_FAILED) {
+            /* some file systems cannot be mapped, but can be read. */
+            check_stream(file, fd);
+        } else if (data) {
+#ifdef POSIX_MADV_SEQUENTIAL
+            posix_madvise(data, length, POSIX_MADV_SEQUENTIAL);
+#endif
+            check_mapped(file, data, length);
+            munmap(data, length);
+        }
+    } else if (S_ISDIR(st.st_mode)) {
+        errno = EISDIR;
+        report_failure(file, "open");
+    } else {
+        check_stream(file, fd);
+    }
+    close(fd);
+}
+
+#ifdef UTF8CHK_THREADS
+/* the files are handed out to the workers one at a time. */
+static file_t *queue;
+static size_t queue_next, queue_count;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        size_t index;
+        pthread_mutex_lock(&queue_lock);
+        index = queue_next < queue_count ? queue_next++ : queue_count;
+        pthread_mutex_unlock(&queue_lock);
+        if (index == queue_count)
+            return NULL;
+        check_file(&queue[index]);
+    }
+}
+#endif
+
+static void check_files(file_t *files, size_t count, unsigned threads) {
+#ifdef UTF8CHK_THREADS
+    pthread_t *workers;
+    unsigned started = 0, i;
+
+    if (threads > count)
+        threads = (unsigned)count;
+    queue = files;
+    queue_next = 0;
+    queue_count = count;
+    workers = threads > 1 ? malloc(threads * sizeof(*workers)) : NULL;
+    if (workers)
+        for (i = 0; i < threads; ++i)
+            if (!pthread_create(&workers[started], NULL, worker, NULL))
+                ++started;
+    /* the calling thread works too, which also covers a failure
+       to start any of the workers. */
+    worker(NULL);
+    for (i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+#else
+    size_t i;
+    (void)threads;
+    for (i = 0; i < count; ++i)
+        check_file(&files[i]);
+#endif
+}
+
+static int usage(const char *program) {
+    fprintf(stderr, "usage: %s [-a] [-q] [-p lax|utf8|mutf8|cesu8|wtf8|"
+                    "strict] [-j jobs] [file...]\n", program);
+    return CLI_FAILED;
+}
+
+int main(int argc, char *argv[]) {
+    static char *standard_input[] = { "-" };
+    char **paths;
+    file_t *files;
+    size_t count, i;
+    unsigned threads = 0;
+    int status = CLI_VALID, option;
+    long cpus;
+
+    flags = presets[1].flags;
+    while ((option = getopt(argc, argv, "aqp:j:")) != -1) {
+        switch (option) {
+        case 'a':
+            all_errors = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'p':
+            for (i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i)
+                if (!strcmp(optarg, presets[i].name))
+                    break;
+            if (i == sizeof(presets) / sizeof(presets[0])) {
+                fprintf(stderr, "utf8chk: unknown preset '%s'\n", optarg);
+                return usage(argv[0]);
+            }
+            flags = presets[i].flags;
+            break;
+        case 'j':
+            threads = (unsigned)strtoul(optarg, NULL, 10);
+            if (!threads)
+                return usage(argv[0]);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+
+    if (!threads) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    count = (size_t)(argc - optind);
+    paths = argv + optind;
+    if (!count) {
+        paths = standard_input;
+        count = 1;
+    }
+    files = calloc(count, sizeof(*files));
+    if (!files) {
+        perror("utf8chk");
+        return CLI_FAILED;
+    }
+    for (i = 0; i < count; ++i)
+        files[i].path = paths[i];
+
+    /* a lone file is split over the threads instead. */
+    if (count == 1)
+        jobs = threads;
+    check_files(files, count, threads);
+
+    for (i = 0; i < count; ++i) {
+        if (files[i].out.length)
+            fwrite(files[i].out.text, 1, files[i].out.length, stdout);
+        if (files[i].err.length)
+            fwrite(files[i].err.text, 1, files[i].err.length, stderr);
+        if (files[i].status > status)
+            status = files[i].status;
+        free(files[i].out.text);
+        free(files[i].err.text);
+    }
+    free(files);
+    if (fflush(stdout))
+        status = CLI_FAILED;
+    return status;
+}
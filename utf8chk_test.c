@@ -1,77 +1,782 @@
 
 #define UTF8CHK_IMPL
+/* let utf8chk_parallel split even the shortest test strings,
+   the DFA kernel (with -DUTF8CHK_DFA) run on them,
+   utf8chk_info and utf8chk_copy split them into blocks (the latter
+   copying the longer ones with non-temporal stores),
+   iterators decode them a few code points at a time, indexes
+   cover them with many blocks, and the terminators of null-terminated
+   strings are looked for (with -DUTF8CHK_SIMD) a few bytes at a time. */
+#define UTF8CHK_PARALLEL_MIN_CHUNK 1
+#define UTF8CHK_DFA_MIN 1
+#define UTF8CHK_INFO_BLOCK 16
+#define UTF8CHK_COPY_BLOCK 8
+#define UTF8CHK_COPY_STREAM_MIN 40
+#define UTF8CHK_ITER_BUFFER 3
+#define UTF8CHK_INDEX_BLOCK 8
+#define UTF8CHK_CSTRING_BLOCK 16
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "utf8chk.h"
 
-static const char *utf8chk_strerr(utf8chk_error_t err) {
-    switch (err) {
-    case UTF8CHK_OK:
-        return "UTF8CHK_OK";
-    case UTF8CHK_ERR_UNEXPECTED_CONT:
-        return "UTF8CHK_ERR_UNEXPECTED_CONT";
-    case UTF8CHK_ERR_INVALID_START_BYTE:
-        return "UTF8CHK_ERR_INVALID_START_BYTE";
-    case UTF8CHK_ERR_RANGE:
-        return "UTF8CHK_ERR_RANGE";
-    case UTF8CHK_ERR_OVERLONG:
-        return "UTF8CHK_ERR_OVERLONG";
-    case UTF8CHK_ERR_NONCHARACTER:
-        return "UTF8CHK_ERR_NONCHARACTER";
-    case UTF8CHK_ERR_SURROGATE:
-        return "UTF8CHK_ERR_SURROGATE";
-    case UTF8CHK_ERR_SURROGATE_LOW:
-        return "UTF8CHK_ERR_SURROGATE_LOW";
-    case UTF8CHK_ERR_SURROGATE_HIGH:
-        return "UTF8CHK_ERR_SURROGATE_HIGH";
-    case UTF8CHK_ERR_NULL_BYTE:
-        return "UTF8CHK_ERR_NULL_BYTE";
-    case UTF8CHK_ERR_EXPECTED_CONT:
-        return "UTF8CHK_ERR_EXPECTED_CONT";
-    case UTF8CHK_ERR_EXPECTED_CONT2:
-        return "UTF8CHK_ERR_EXPECTED_CONT2";
-    case UTF8CHK_ERR_EXPECTED_CONT3:
-        return "UTF8CHK_ERR_EXPECTED_CONT3";
-    case UTF8CHK_ERR_TRUNC:
-        return "UTF8CHK_ERR_TRUNC";
-    case UTF8CHK_ERR_TRUNC2:
-        return "UTF8CHK_ERR_TRUNC2";
-    case UTF8CHK_ERR_TRUNC3:
-        return "UTF8CHK_ERR_TRUNC3";
-    case UTF8CHK_ERR_SURROGATE_TRUNC:
-        return "UTF8CHK_ERR_SURROGATE_TRUNC";
-    default:
-        return "<\?\?\?>";    
+/* runs the jobs backwards, so that the chunks after the first error
+   are validated before it. */
+static void reverse_executor(void *context, utf8chk_job_t job,
+                             void *arg, size_t count) {
+    (void)context;
+    while (count--)
+        job(arg, count);
+}
+
+static int check_result(const char *string,
+              utf8chk_error_t err, size_t expected_error_at_index,
+              size_t expected_error_len, utf8chk_error_t got,
+              const char *error_at, size_t error_len) {
+    if (got != err) {
+        printf("FAIL (expected err=%s, got err=%s)\n", utf8chk_strerr(err), utf8chk_strerr(got));
+        return 1;
     }
+    if ((size_t)(error_at - string) != expected_error_at_index) {
+        printf("FAIL (expected error_at=%zu, got error_at=%zu)\n", expected_error_at_index, (size_t)(error_at - string));
+        return 1;
+    }
+    if (error_len != expected_error_len) {
+        printf("FAIL (expected error_len=%zu, got error_len=%zu)\n", expected_error_len, error_len);
+        return 1;
+    }
+    return 0;
 }
 
-static int test_case(const char *name, const char *string, size_t length,
+static int check_case(const char *string, size_t length,
               utf8chk_flag_t flags, utf8chk_error_t err,
               size_t expected_error_at_index, size_t expected_error_len) {
     const char *error_at;
     size_t error_len;
+    unsigned threads;
     utf8chk_error_t got = utf8chk(string, length, flags, &error_at, &error_len);
-            
+
+    if (check_result(string, err, expected_error_at_index,
+                     expected_error_len, got, error_at, error_len))
+        return 1;
+
+    if (!utf8chk_valid(string, length, flags) != !!err) {
+        printf("FAIL (utf8chk_valid says the string is %s)\n",
+               err ? "valid" : "invalid");
+        return 1;
+    }
+
+    for (threads = 2; threads <= 6; ++threads) {
+        got = utf8chk_parallel(string, length, flags, &error_at, &error_len,
+                               threads, reverse_executor, NULL);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            printf("    (in parallel, %u chunks)\n", threads);
+            return 1;
+        }
+    }
+
+    got = utf8chk_parallel(string, length, flags, &error_at, &error_len,
+                           4, NULL, NULL);
+    if (check_result(string, err, expected_error_at_index,
+                     expected_error_len, got, error_at, error_len)) {
+        puts("    (in parallel, default executor)");
+        return 1;
+    }
+
+    {
+        /* a string never decodes into more code points than it has bytes. */
+        size_t size = length == UTF8CHK_CSTRING ? strlen(string) : length;
+        utf8chk_uchar_t *out = malloc((size + 1) * sizeof(utf8chk_uchar_t));
+        utf8chk_iter_t iter;
+        utf8chk_uchar_t u;
+        size_t out_len, i;
+        if (!out) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        got = utf8chk_decode32(string, length, flags, out, size + 1, &out_len,
+                               &error_at, &error_len);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            puts("    (utf8chk_decode32)");
+            free(out);
+            return 1;
+        }
+
+        /* the iterator returns the same code points, then the error. */
+        utf8chk_iter_init(&iter, string, length, flags);
+        for (i = 0; !(got = utf8chk_iter_next(&iter, &u, &error_at,
+                                              &error_len))
+                    && u != UTF8CHK_ITER_END; ++i) {
+            if (i == out_len || u != out[i]) {
+                printf("FAIL (utf8chk_iter_next returned U+%04lX "
+                       "as code point %zu)\n", (unsigned long)u, i);
+                free(out);
+                return 1;
+            }
+        }
+        free(out);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            puts("    (utf8chk_iter_next)");
+            return 1;
+        }
+        if (i != out_len) {
+            printf("FAIL (utf8chk_iter_next returned %zu code points, "
+                   "utf8chk_decode32 wrote %zu)\n", i, out_len);
+            return 1;
+        }
+    }
+
+    {
+        /* nor into more Latin-1 bytes, which stop at the same error or
+           at a code point before it that does not fit. */
+        size_t size = length == UTF8CHK_CSTRING ? strlen(string) : length;
+        size_t out_len;
+        char *out = malloc(size + 1);
+        int ascii;
+        if (!out) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        for (ascii = 0; ascii <= 1; ++ascii) {
+            got = utf8chk_to_latin1(string, length, flags, ascii, out,
+                                    size + 1, &out_len, &error_at,
+                                    &error_len);
+            if (got == UTF8CHK_ERR_UNREPRESENTABLE
+                    && (size_t)(error_at - string) < expected_error_at_index
+                                                   + !err * size)
+                continue;
+            if (check_result(string, err, expected_error_at_index,
+                             expected_error_len, got, error_at, error_len)) {
+                printf("    (utf8chk_to_latin1, %s)\n",
+                       ascii ? "ASCII" : "Latin-1");
+                free(out);
+                return 1;
+            }
+        }
+        free(out);
+    }
+
+    if (length != UTF8CHK_CSTRING) {
+        /* the copy has the bytes before the error. */
+        char *copy = malloc(length + 1);
+        size_t copied_at;
+        if (!copy) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        got = utf8chk_copy(copy, string, length, flags, &copied_at,
+                           &error_len);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, string + copied_at,
+                         error_len)) {
+            puts("    (utf8chk_copy)");
+            free(copy);
+            return 1;
+        }
+        if (memcmp(copy, string, copied_at)) {
+            puts("FAIL (utf8chk_copy did not copy the bytes before the "
+                 "error)");
+            free(copy);
+            return 1;
+        }
+        free(copy);
+    }
+
+    if (length != UTF8CHK_CSTRING) {
+        /* an index over the string validates it and every slice of it
+           the same as utf8chk. */
+        unsigned char *blocks = malloc(UTF8CHK_INDEX_BLOCKS(length) + 1);
+        utf8chk_index_t index;
+        size_t begin, end, slice_len;
+        const char *slice_at;
+        if (!blocks) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        utf8chk_index_build(&index, string, length, flags, blocks);
+        got = utf8chk_index_check(&index, 0, length, &error_at, &error_len);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            puts("    (utf8chk_index_check)");
+            free(blocks);
+            return 1;
+        }
+        for (begin = 0; begin < length; ++begin) {
+            for (end = begin; end <= length; ++end) {
+                utf8chk_error_t slice_err = utf8chk(string + begin,
+                        end - begin, flags, &slice_at, &slice_len);
+                got = utf8chk_index_check(&index, begin, end, &error_at,
+                                          &error_len);
+                if (check_result(string, slice_err,
+                                 (size_t)(slice_at - string), slice_len,
+                                 got, error_at, error_len)) {
+                    printf("    (utf8chk_index_check from %zu to %zu)\n",
+                           begin, end);
+                    free(blocks);
+                    return 1;
+                }
+            }
+        }
+        free(blocks);
+    }
+
+    {
+        /* nor into more UTF-16 code units than it has bytes. */
+        size_t size = length == UTF8CHK_CSTRING ? strlen(string) : length;
+        size_t out_len, counted;
+        utf8chk_char16_t *out = malloc((size + 1) * sizeof(utf8chk_char16_t));
+        if (!out) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        got = utf8chk_to_utf16(string, length, flags, out, size + 1, &out_len,
+                               &error_at, &error_len);
+        free(out);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            puts("    (utf8chk_to_utf16)");
+            return 1;
+        }
+        got = utf8chk_utf16_length(string, length, flags, &counted,
+                                   &error_at, &error_len);
+        if (check_result(string, err, expected_error_at_index,
+                         expected_error_len, got, error_at, error_len)) {
+            puts("    (utf8chk_utf16_length)");
+            return 1;
+        }
+        if (counted != out_len) {
+            printf("FAIL (utf8chk_utf16_length counted %zu code units, "
+                   "utf8chk_to_utf16 wrote %zu)\n", counted, out_len);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* feeds the string to a stream in chunks of chunk bytes, except that the
+   first chunk is split bytes long, and checks that the result is the same
+   as that of utf8chk. */
+static int check_stream_case(const char *string, size_t length,
+              utf8chk_flag_t flags, utf8chk_error_t err,
+              size_t expected_error_at_index, size_t expected_error_len,
+              size_t split, size_t chunk) {
+    utf8chk_stream_t stream;
+    size_t offset = 0, next = split, error_at, error_len;
+    utf8chk_error_t got = UTF8CHK_OK;
+
+    utf8chk_stream_init(&stream, flags);
+    while (offset < length && !got) {
+        if (next > length - offset) next = length - offset;
+        got = utf8chk_stream_feed(&stream, string + offset, next,
+                                  &error_at, &error_len);
+        offset += next;
+        next = chunk;
+    }
+    got = utf8chk_stream_finish(&stream, &error_at, &error_len);
+
+    if (got != err || error_at != expected_error_at_index
+                   || error_len != expected_error_len) {
+        printf("FAIL (stream split at %zu into chunks of %zu: "
+               "expected %s at %zu+%zu, got %s at %zu+%zu)\n",
+               split, chunk, utf8chk_strerr(err), expected_error_at_index,
+               expected_error_len, utf8chk_strerr(got), error_at, error_len);
+        return 1;
+    }
+    return 0;
+}
+
+/* run every case again behind ASCII prefixes of various lengths, so that
+   the string lands on different word alignments and the fast paths that
+   skip over ASCII runs get exercised. */
+static const size_t test_prefixes[] = { 1, 7, 16, 61 };
+
+static int test_case(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, utf8chk_error_t err,
+              size_t expected_error_at_index, size_t expected_error_len) {
+    size_t i, size = length == UTF8CHK_CSTRING ? strlen(string) + 1 : length;
+
     printf("Test '%s'... ", name);
     fflush(stdout);
-    if (got != err) {
-        printf("FAIL (expected err=%s, got err=%s)\n", utf8chk_strerr(err), utf8chk_strerr(got));
+    if (check_case(string, length, flags, err,
+                   expected_error_at_index, expected_error_len))
         return 1;
+
+    if (length != UTF8CHK_CSTRING) {
+        /* split the string at every position, and feed it a byte
+           at a time. */
+        for (i = 0; i <= length; ++i)
+            if (check_stream_case(string, length, flags, err,
+                                  expected_error_at_index, expected_error_len,
+                                  i, length))
+                return 1;
+        if (check_stream_case(string, length, flags, err,
+                              expected_error_at_index, expected_error_len,
+                              1, 1))
+            return 1;
     }
-    if ((size_t)(error_at - string) != expected_error_at_index) {
-        printf("FAIL (expected error_at=%zu, got error_at=%zu)\n", expected_error_at_index, (size_t)(error_at - string));
+
+    for (i = 0; i < sizeof(test_prefixes) / sizeof(test_prefixes[0]); ++i) {
+        size_t prefix = test_prefixes[i];
+        char *buffer = malloc(prefix + size + 1);
+        int failed;
+        if (!buffer) {
+            puts("FAIL (out of memory)");
+            return 1;
+        }
+        memset(buffer, 'x', prefix);
+        memcpy(buffer + prefix, string, size);
+        failed = check_case(buffer, length == UTF8CHK_CSTRING
+                                    ? length : prefix + length,
+                            flags, err, prefix + expected_error_at_index,
+                            expected_error_len);
+        free(buffer);
+        if (failed) {
+            printf("    (with %zu-byte ASCII prefix)\n", prefix);
+            return 1;
+        }
+    }
+
+    puts("OK");
+    return 0;
+}
+
+static int test_decode32(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, size_t out_size, utf8chk_error_t err,
+              size_t expected_error_at_index,
+              const utf8chk_uchar_t *expected, size_t expected_len) {
+    utf8chk_uchar_t out[64];
+    const char *error_at;
+    size_t i, error_len, out_len;
+    utf8chk_error_t got;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    got = utf8chk_decode32(string, length, flags, out, out_size, &out_len,
+                           &error_at, &error_len);
+    if (got != err || (size_t)(error_at - string) != expected_error_at_index) {
+        printf("FAIL (expected %s at %zu, got %s at %zu)\n",
+               utf8chk_strerr(err), expected_error_at_index,
+               utf8chk_strerr(got), (size_t)(error_at - string));
         return 1;
     }
-    if (error_len != expected_error_len) {
-        printf("FAIL (expected error_len=%zu, got error_len=%zu)\n", expected_error_len, error_len);
+    if (out_len != expected_len) {
+        printf("FAIL (expected %zu code points, got %zu)\n",
+               expected_len, out_len);
+        return 1;
+    }
+    for (i = 0; i < out_len; ++i) {
+        if (out[i] != expected[i]) {
+            printf("FAIL (expected U+%04lX at %zu, got U+%04lX)\n",
+                   (unsigned long)expected[i], i, (unsigned long)out[i]);
+            return 1;
+        }
+    }
+    puts("OK");
+    return 0;
+}
+
+static int test_to_utf16(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, size_t out_size, utf8chk_error_t err,
+              size_t expected_error_at_index,
+              const utf8chk_char16_t *expected, size_t expected_len) {
+    utf8chk_char16_t out[64];
+    const char *error_at;
+    size_t i, error_len, out_len;
+    utf8chk_error_t got;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    got = utf8chk_to_utf16(string, length, flags, out, out_size, &out_len,
+                           &error_at, &error_len);
+    if (got != err || (size_t)(error_at - string) != expected_error_at_index) {
+        printf("FAIL (expected %s at %zu, got %s at %zu)\n",
+               utf8chk_strerr(err), expected_error_at_index,
+               utf8chk_strerr(got), (size_t)(error_at - string));
+        return 1;
+    }
+    if (out_len != expected_len) {
+        printf("FAIL (expected %zu code units, got %zu)\n",
+               expected_len, out_len);
+        return 1;
+    }
+    for (i = 0; i < out_len; ++i) {
+        if (out[i] != expected[i]) {
+            printf("FAIL (expected %04X at %zu, got %04X)\n",
+                   (unsigned)expected[i], i, (unsigned)out[i]);
+            return 1;
+        }
+    }
+    if (got == UTF8CHK_OK) {
+        /* a buffer of the counted size must be enough. */
+        size_t counted;
+        utf8chk_utf16_length(string, length, flags, &counted, NULL, NULL);
+        if (counted != out_len) {
+            printf("FAIL (utf8chk_utf16_length counted %zu code units)\n",
+                   counted);
+            return 1;
+        }
+    }
+    puts("OK");
+    return 0;
+}
+
+#define UTF16_CASE(name, string, length, flags, out_size, expected,          \
+                   error_at, code_units)                                       \
+    if (test_to_utf16(name, string, length, flags, out_size, expected,        \
+                      error_at, code_units,                                    \
+                      sizeof(code_units) / sizeof(code_units[0])))             \
+        ++fail;
+
+static int test_to_latin1(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, int ascii, size_t out_size,
+              utf8chk_error_t err, size_t expected_error_at_index,
+              const char *expected, size_t expected_len) {
+    char out[64];
+    const char *error_at;
+    size_t error_len, out_len;
+    utf8chk_error_t got;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    got = utf8chk_to_latin1(string, length, flags, ascii, out, out_size,
+                            &out_len, &error_at, &error_len);
+    if (got != err || (size_t)(error_at - string) != expected_error_at_index) {
+        printf("FAIL (expected %s at %zu, got %s at %zu)\n",
+               utf8chk_strerr(err), expected_error_at_index,
+               utf8chk_strerr(got), (size_t)(error_at - string));
+        return 1;
+    }
+    if (out_len != expected_len || memcmp(out, expected, out_len)) {
+        printf("FAIL (expected %zu bytes, got %zu, or different ones)\n",
+               expected_len, out_len);
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}
+
+#define LATIN1_CASE(name, string, length, flags, ascii, out_size, expected,  \
+                    error_at, bytes)                                           \
+    if (test_to_latin1(name, string, length, flags, ascii, out_size,          \
+                       expected, error_at, bytes, sizeof(bytes) - 1))          \
+        ++fail;
+
+static int test_sanitize(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, const char *expected, size_t expected_len,
+              utf8chk_error_t counted, size_t expected_count) {
+    char out[256];
+    size_t counts[UTF8CHK_ERR_LIMIT], out_len;
+    utf8chk_error_t got;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    got = utf8chk_sanitize(string, length, flags, out, sizeof(out), &out_len,
+                           counts, NULL, NULL);
+    if (got != UTF8CHK_OK) {
+        printf("FAIL (got err=%s)\n", utf8chk_strerr(got));
+        return 1;
+    }
+    if (out_len != expected_len || memcmp(out, expected, out_len)) {
+        printf("FAIL (expected %zu bytes, got %zu bytes that differ)\n",
+               expected_len, out_len);
+        return 1;
+    }
+    if (counts[counted] != expected_count) {
+        printf("FAIL (expected %zu of %s, got %zu)\n", expected_count,
+               utf8chk_strerr(counted), counts[counted]);
+        return 1;
+    }
+
+    /* and in place, with room for the replacements. */
+    memcpy(out, string, length);
+    got = utf8chk_sanitize(out, length, flags, out, sizeof(out), &out_len,
+                           NULL, NULL, NULL);
+    if (got != UTF8CHK_OK || out_len != expected_len
+                          || memcmp(out, expected, out_len)) {
+        puts("FAIL (in place)");
+        return 1;
+    }
+    puts("OK");
+    return 0;
+}
+
+#define SANITIZE_CASE(name, string, length, flags, expected, expected_len,   \
+                      counted, count)                                          \
+    if (test_sanitize(name, string, length, flags, expected, expected_len,    \
+                      counted, count))                                         \
+        ++fail;
+
+static int test_all(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, size_t max_errors, size_t expected_found,
+              const utf8chk_error_record_t *expected, size_t expected_len) {
+    utf8chk_error_record_t errors[16];
+    size_t i, found;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    found = utf8chk_all(string, length, flags, errors, max_errors);
+    if (found != expected_found) {
+        printf("FAIL (expected %zu errors, found %zu)\n",
+               expected_found, found);
+        return 1;
+    }
+    for (i = 0; i < expected_len && i < found; ++i) {
+        if (errors[i].error != expected[i].error
+                || errors[i].offset != expected[i].offset
+                || errors[i].length != expected[i].length) {
+            printf("FAIL (expected %s at %zu+%zu, got %s at %zu+%zu)\n",
+                   utf8chk_strerr(expected[i].error), expected[i].offset,
+                   expected[i].length, utf8chk_strerr(errors[i].error),
+                   errors[i].offset, errors[i].length);
+            return 1;
+        }
+    }
+    puts("OK");
+    return 0;
+}
+
+/* short strings for utf8chk_batch, laid out one after another. */
+static const char batch_data[] =
+    "key" "caf\xc3\xa9" "" "\xff" "x-forwarded-for" "\xc0\x80" "a\0b"
+    "\xed\xa0\x81\xed\xb0\x80" "\xef\xbf\xbf" "\xe3\x83" "\xf0\x9f\x98\x83"
+    "The quick brown fox jumps over the lazy dog. The quick brown fox.";
+static const utf8chk_offset_t batch_offsets[] = {
+    0, 3, 8, 8, 9, 24, 26, 29, 35, 38, 40, 44, 109
+};
+#define BATCH_COUNT (sizeof(batch_offsets) / sizeof(batch_offsets[0]) - 1)
+
+/* checks utf8chk_batch and utf8chk_batch_offsets against utf8chk for
+   every string in batch_data. */
+static int test_batch(const char *name, utf8chk_flag_t flags) {
+    const char *strings[BATCH_COUNT];
+    size_t lengths[BATCH_COUNT], i, invalid = 0, found;
+    utf8chk_error_t expected[BATCH_COUNT], results[BATCH_COUNT];
+    char copies[BATCH_COUNT][80];
+    const char *cstrings[BATCH_COUNT];
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    for (i = 0; i < BATCH_COUNT; ++i) {
+        strings[i] = batch_data + batch_offsets[i];
+        lengths[i] = (size_t)(batch_offsets[i + 1] - batch_offsets[i]);
+        expected[i] = utf8chk(strings[i], lengths[i], flags, NULL, NULL);
+        if (expected[i]) ++invalid;
+    }
+
+    found = utf8chk_batch(strings, lengths, BATCH_COUNT, flags, results);
+    for (i = 0; i < BATCH_COUNT; ++i) {
+        if (results[i] != expected[i]) {
+            printf("FAIL (string %zu: expected %s, got %s)\n", i,
+                   utf8chk_strerr(expected[i]), utf8chk_strerr(results[i]));
+            return 1;
+        }
+    }
+    if (found != invalid) {
+        printf("FAIL (expected %zu invalid strings, got %zu)\n",
+               invalid, found);
+        return 1;
+    }
+    if (utf8chk_batch(strings, lengths, BATCH_COUNT, flags, NULL)
+            != (invalid != 0)) {
+        puts("FAIL (without results)");
+        return 1;
+    }
+
+    memset(results, 0xFF, sizeof(results));
+    found = utf8chk_batch_offsets(batch_data, batch_offsets, BATCH_COUNT,
+                                  flags, results);
+    if (found != invalid || memcmp(results, expected, sizeof(results))) {
+        puts("FAIL (with offsets)");
+        return 1;
+    }
+
+    for (i = 0; i < BATCH_COUNT; ++i) {
+        memcpy(copies[i], strings[i], lengths[i]);
+        copies[i][lengths[i]] = 0;
+        cstrings[i] = copies[i];
+        expected[i] = utf8chk(cstrings[i], UTF8CHK_CSTRING, flags,
+                              NULL, NULL);
+    }
+    utf8chk_batch(cstrings, NULL, BATCH_COUNT, flags, results);
+    if (memcmp(results, expected, sizeof(results))) {
+        puts("FAIL (null-terminated)");
+        return 1;
+    }
+
+    puts("OK");
+    return 0;
+}
+
+/* places the string in ASCII so that utf8chk_parallel splits it into two
+   chunks after its first split bytes, and checks it against utf8chk. */
+static int test_parallel(const char *name, const char *string,
+              size_t length, size_t split, utf8chk_flag_t flags) {
+    char buffer[64];
+    const char *error_at, *want_at;
+    size_t error_len, want_len;
+    utf8chk_error_t got, want;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    memset(buffer, 'a', sizeof(buffer));
+    memcpy(buffer + sizeof(buffer) / 2 - split, string, length);
+    want = utf8chk(buffer, sizeof(buffer), flags, &want_at, &want_len);
+    got = utf8chk_parallel(buffer, sizeof(buffer), flags, &error_at,
+                           &error_len, 2, reverse_executor, NULL);
+    if (check_result(buffer, want, (size_t)(want_at - buffer), want_len,
+                     got, error_at, error_len))
+        return 1;
+    puts("OK");
+    return 0;
+}
+
+/* what test_revalidate splices into its documents. */
+static const char *const revalidate_snippets[] = {
+    "", "x", "\xc3\xa9", "\xe6\x97", "\x80\x80", "\xed\xa0\x81",
+    "\xed\xb0\x80", "\xed\xa0\x81\xed\xb0\x80", "\xf0\x9f\x98\x80",
+    "\xf0\x8d\xa0\x81", "\xf0\x8d\xb0\x80"
+};
+
+/* replaces every range of a valid document with every snippet, and checks
+   utf8chk_revalidate against utf8chk on the result. */
+static int test_revalidate(const char *name, const char *document,
+              utf8chk_flag_t flags) {
+    size_t length = strlen(document), begin, end, i;
+    char edited[128];
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    if (utf8chk(document, length, flags, NULL, NULL)) {
+        puts("FAIL (the document is not valid to begin with)");
+        return 1;
+    }
+    for (begin = 0; begin <= length; ++begin) {
+        for (end = begin; end <= length; ++end) {
+            for (i = 0; i < sizeof(revalidate_snippets)
+                                / sizeof(revalidate_snippets[0]); ++i) {
+                const char *snippet = revalidate_snippets[i];
+                size_t size = strlen(snippet), total, got_len, want_len;
+                const char *got_at, *want_at;
+                utf8chk_error_t got, want;
+
+                memcpy(edited, document, begin);
+                memcpy(edited + begin, snippet, size);
+                memcpy(edited + begin + size, document + end, length - end);
+                total = length - (end - begin) + size;
+                want = utf8chk(edited, total, flags, &want_at, &want_len);
+                got = utf8chk_revalidate(edited, total, flags, begin,
+                                         begin + size, &got_at, &got_len);
+                if (got != want || got_at != want_at
+                        || got_len != want_len) {
+                    printf("FAIL (bytes %zu to %zu replaced with snippet "
+                           "%zu: expected %s at %zu+%zu, got %s at "
+                           "%zu+%zu)\n", begin, end, i,
+                           utf8chk_strerr(want),
+                           (size_t)(want_at - edited), want_len,
+                           utf8chk_strerr(got), (size_t)(got_at - edited),
+                           got_len);
+                    return 1;
+                }
+            }
+        }
+    }
+    puts("OK");
+    return 0;
+}
+
+static int test_column(const char *name, const char *data,
+              const utf8chk_offset_t *offsets, size_t count,
+              utf8chk_flag_t flags, size_t expected_row, utf8chk_error_t err,
+              size_t expected_error_at_index, size_t expected_error_len) {
+    utf8chk_error_record_t error;
+    size_t row;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    row = utf8chk_column(data, offsets, count, flags, &error);
+    if (row != expected_row) {
+        printf("FAIL (expected row %zu, got row %zu)\n", expected_row, row);
+        return 1;
+    }
+    if (row < count && (error.error != err
+                        || error.offset != expected_error_at_index
+                        || error.length != expected_error_len)) {
+        printf("FAIL (expected %s at %zu+%zu, got %s at %zu+%zu)\n",
+               utf8chk_strerr(err), expected_error_at_index,
+               expected_error_len, utf8chk_strerr(error.error),
+               error.offset, error.length);
         return 1;
     }
     puts("OK");
     return 0;
 }
 
+/* expected is code_points, sequences[0..3], newlines, line, column
+   and code_point_column. */
+static int test_info(const char *name, const char *string, size_t length,
+              utf8chk_flag_t flags, utf8chk_error_t err,
+              size_t expected_error_at_index, const size_t *expected) {
+    utf8chk_text_info_t info;
+    const char *error_at;
+    size_t error_len, got[9], i;
+    utf8chk_error_t got_err;
+
+    printf("Test '%s'... ", name);
+    fflush(stdout);
+    got_err = utf8chk_info(string, length, flags, &error_at, &error_len,
+                           &info);
+    if (got_err != err || error_at != string + expected_error_at_index) {
+        printf("FAIL (expected %s at %zu, got %s at %zu)\n",
+               utf8chk_strerr(err), expected_error_at_index,
+               utf8chk_strerr(got_err), (size_t)(error_at - string));
+        return 1;
+    }
+    got[0] = info.code_points;
+    for (i = 0; i < 4; ++i)
+        got[1 + i] = info.sequences[i];
+    got[5] = info.newlines;
+    got[6] = info.line;
+    got[7] = info.column;
+    got[8] = info.code_point_column;
+    for (i = 0; i < 9; ++i) {
+        if (got[i] != expected[i]) {
+            printf("FAIL (expected %zu for statistic %zu, got %zu)\n",
+                   expected[i], i, got[i]);
+            return 1;
+        }
+    }
+    puts("OK");
+    return 0;
+}
+
+#define COLUMN_CASE(name, data, offsets, flags, row, expected, error_at,      \
+                    error_len)                                                 \
+    if (test_column(name, data, offsets,                                       \
+                    sizeof(offsets) / sizeof(offsets[0]) - 1, flags, row,      \
+                    expected, error_at, error_len))                            \
+        ++fail;
+
+#define INFO_CASE(name, string, length, flags, expected, error_at, stats)    \
+    if (test_info(name, string, length, flags, expected, error_at, stats))     \
+        ++fail;
+
+#define ALL_CASE(name, string, length, flags, max_errors, found, records)    \
+    if (test_all(name, string, length, flags, max_errors, found, records,     \
+                 sizeof(records) / sizeof(records[0])))                        \
+        ++fail;
+
+#define DECODE_CASE(name, string, length, flags, out_size, expected,         \
+                    error_at, code_points)                                     \
+    if (test_decode32(name, string, length, flags, out_size, expected,        \
+                      error_at, code_points,                                   \
+                      sizeof(code_points) / sizeof(code_points[0])))           \
+        ++fail;
+
 #define TEST_CASE(name, string, length, flags, expected, error_at, error_len)  \
     if (test_case(name, string, length, flags, expected, error_at, error_len)) \
         ++fail;
@@ -478,6 +1183,689 @@ static int run_tests(void) {
         "\xed\xa0\x81\xed\xa0\x81",
         6, UTF8CHK_WTF8, UTF8CHK_OK, 6, 0
     );
+    TEST_CASE(
+        "Long ASCII run",
+        "The quick brown fox jumps over the lazy dog. The quick brown fox.",
+        UTF8CHK_CSTRING, UTF8CHK_UTF8, UTF8CHK_OK, 65, 0
+    );
+    TEST_CASE(
+        "Long ASCII run with explicit length",
+        "The quick brown fox jumps over the lazy dog. The quick brown fox.",
+        65, UTF8CHK_UTF8, UTF8CHK_OK, 65, 0
+    );
+    TEST_CASE(
+        "Error after long ASCII run",
+        "The quick brown fox jumps over the lazy dog. The quick brown fox\x80",
+        UTF8CHK_CSTRING, UTF8CHK_UTF8, UTF8CHK_ERR_UNEXPECTED_CONT, 64, 1
+    );
+    TEST_CASE(
+        "Null byte after long ASCII run allowed",
+        "The quick brown fox jumps over the lazy dog.\x00The quick brown fox.",
+        65, UTF8CHK_UTF8, UTF8CHK_OK, 65, 0
+    );
+    TEST_CASE(
+        "Null byte after long ASCII run banned",
+        "The quick brown fox jumps over the lazy dog.\x00The quick brown fox.",
+        65, UTF8CHK_UTF8 | UTF8CHK_BAN_NULL_BYTE, UTF8CHK_ERR_NULL_BYTE, 44, 1
+    );
+    TEST_CASE(
+        "Null terminator after long ASCII run",
+        "The quick brown fox jumps over the lazy dog.\x00The quick brown fox.",
+        UTF8CHK_CSTRING, UTF8CHK_UTF8, UTF8CHK_OK, 44, 0
+    );
+    TEST_CASE(
+        "Multibyte sequences between ASCII runs",
+        "The quick brown \xc3\xa9 fox jumps over the \xe3\x83\x84 lazy dog.",
+        UTF8CHK_CSTRING, UTF8CHK_UTF8, UTF8CHK_OK, 51, 0
+    );
+    TEST_CASE(
+        "High surrogate followed by ASCII",
+        "\xed\xa0\x81" "abc",
+        6, UTF8CHK_CESU8, UTF8CHK_OK, 6, 0
+    );
+    TEST_CASE(
+        "Low surrogate after ASCII after high surrogate",
+        "\xed\xa0\x81" "abc" "\xed\xb0\x80",
+        9, UTF8CHK_CESU8, UTF8CHK_ERR_SURROGATE_LOW, 6, 3
+    );
+    TEST_CASE(
+        "Long multibyte string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        88, UTF8CHK_UTF8, UTF8CHK_OK, 88, 0
+    );
+    TEST_CASE(
+        "Error late in long multibyte string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe0\x80\x80" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        102, UTF8CHK_UTF8, UTF8CHK_ERR_OVERLONG, 88, 3
+    );
+    TEST_CASE(
+        "Truncated sequence at end of long multibyte string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xf0\x9f\x98",
+        91, UTF8CHK_UTF8, UTF8CHK_ERR_TRUNC, 88, 3
+    );
+    TEST_CASE(
+        "Truncated sequence before long ASCII run",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "abcdefg"
+        "\xe3\x83" "The quick brown fox jumps over the lazy dog. The quick brown fox.",
+        UTF8CHK_CSTRING, UTF8CHK_UTF8, UTF8CHK_ERR_EXPECTED_CONT, 62, 2
+    );
+    TEST_CASE(
+        "C0 80 in long MUTF-8 string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xc0\x80" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        90, UTF8CHK_MUTF8, UTF8CHK_OK, 90, 0
+    );
+    TEST_CASE(
+        "C0 80 as last two bytes",
+        "ab\xc0\x80",
+        4, UTF8CHK_MUTF8, UTF8CHK_OK, 4, 0
+    );
+    TEST_CASE(
+        "C0 80 before two more bytes",
+        "\xc0\x80" "ab",
+        4, UTF8CHK_MUTF8, UTF8CHK_OK, 4, 0
+    );
+    TEST_CASE(
+        "C0 80 in null-terminated string",
+        "a\xc0\x80" "b",
+        UTF8CHK_CSTRING, UTF8CHK_MUTF8, UTF8CHK_OK, 4, 0
+    );
+    TEST_CASE(
+        "Surrogate pair in long CESU-8 string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xed\xa0\x81\xed\xb0\x80" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        94, UTF8CHK_CESU8, UTF8CHK_OK, 94, 0
+    );
+    TEST_CASE(
+        "Overlong low surrogate in long string",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xf0\x8d\xb0\x80" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        103, UTF8CHK_CHECK_SURROGATES, UTF8CHK_ERR_SURROGATE_LOW, 88, 4
+    );
+    TEST_CASE(
+        "Noncharacter late in long string when banned",
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy"
+        "\xf3\xbf\xbf\xbe" "\xe3\x83\x84\xc3\xa9\xf0\x9f\x98\x83xy",
+        103, UTF8CHK_UTF8 | UTF8CHK_BAN_NONCHARACTERS,
+        UTF8CHK_ERR_NONCHARACTER, 88, 4
+    );
+    TEST_CASE(
+        "Overlong high surrogate before low surrogate",
+        "ab\xf0\x8d\xa0\x80\xed\xb0\x80" "cd",
+        11, UTF8CHK_CHECK_SURROGATES, UTF8CHK_OK, 11, 0
+    );
+    TEST_CASE(
+        "Overlong low surrogate after high surrogate",
+        "ab\xed\xa0\x80\xf0\x8d\xb0\x80" "cd",
+        11, UTF8CHK_CHECK_SURROGATES, UTF8CHK_OK, 11, 0
+    );
+    TEST_CASE(
+        "Overlong surrogate pair",
+        "ab\xf0\x8d\xa0\x80\xf0\x8d\xb0\x80" "cd",
+        12, UTF8CHK_CHECK_SURROGATES, UTF8CHK_OK, 12, 0
+    );
+    TEST_CASE(
+        "Unpaired overlong high surrogate at end",
+        "ab\xf0\x8d\xa0\x80",
+        6, UTF8CHK_CHECK_SURROGATES, UTF8CHK_ERR_SURROGATE_TRUNC, 2, 4
+    );
+    {
+        static const utf8chk_uchar_t expected[] = {
+            'A', 'S', 'C', 'I', 'I', ' ', 'r', 'u', 'n', ' ', 'l', 'o',
+            'n', 'g', 'e', 'r', ' ', 't', 'h', 'a', 'n', ' ', 'a', ' ',
+            'v', 'e', 'c', 't', 'o', 'r', 0xE9, 0x30C4, 0x1F603, '!'
+        };
+        DECODE_CASE(
+            "Decode ASCII run and multibyte sequences",
+            "ASCII run longer than a vector\xc3\xa9\xe3\x83\x84\xf0\x9f\x98\x83!",
+            40, UTF8CHK_UTF8, 64, UTF8CHK_OK, 40, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 'a', 0x10401, 'b' };
+        DECODE_CASE(
+            "Decode CESU-8 surrogate pair",
+            "a\xed\xa0\x81\xed\xb0\x81" "b",
+            8, UTF8CHK_CESU8, 64, UTF8CHK_OK, 8, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 0xD801, 'a' };
+        DECODE_CASE(
+            "Decode unpaired high surrogate in CESU-8",
+            "\xed\xa0\x81" "a",
+            4, UTF8CHK_CESU8, 64, UTF8CHK_OK, 4, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 0x10000 };
+        DECODE_CASE(
+            "Decode surrogate pair with overlong low surrogate",
+            "\xed\xa0\x80\xf0\x8d\xb0\x80",
+            7, UTF8CHK_CHECK_SURROGATES, 64, UTF8CHK_OK, 7, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 0xDC01, 0xD801 };
+        DECODE_CASE(
+            "Decode surrogates in WTF-8",
+            "\xed\xb0\x81\xed\xa0\x81",
+            6, UTF8CHK_WTF8, 64, UTF8CHK_OK, 6, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 'x', 0, 'y' };
+        DECODE_CASE(
+            "Decode C0 80 in MUTF-8",
+            "x\xc0\x80y",
+            UTF8CHK_CSTRING, UTF8CHK_MUTF8, 64, UTF8CHK_OK, 4, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 'a', 'b', 0xE9 };
+        DECODE_CASE(
+            "Decode up to error",
+            "ab\xc3\xa9\xc3" "c",
+            6, UTF8CHK_UTF8, 64, UTF8CHK_ERR_EXPECTED_CONT, 4, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = { 'a' };
+        DECODE_CASE(
+            "Decode surrogate pair into full buffer",
+            "a\xed\xa0\x81\xed\xb0\x81" "b",
+            8, UTF8CHK_CESU8, 1, UTF8CHK_ERR_NO_SPACE, 1, expected
+        );
+    }
+    {
+        static const utf8chk_uchar_t expected[] = {
+            'A', 'S', 'C', 'I', 'I', ' ', 'r', 'u', 'n', ' ', 'l', 'o',
+            'n', 'g', 'e', 'r', ' ', 't'
+        };
+        DECODE_CASE(
+            "Decode ASCII run into full buffer",
+            "ASCII run longer than a vector",
+            30, UTF8CHK_UTF8, 18, UTF8CHK_ERR_NO_SPACE, 18, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = {
+            'A', 'S', 'C', 'I', 'I', ' ', 'r', 'u', 'n', ' ', 'l', 'o',
+            'n', 'g', 'e', 'r', ' ', 't', 'h', 'a', 'n', ' ', 'a', ' ',
+            'v', 'e', 'c', 't', 'o', 'r', 0xE9, 0x30C4, 0xD83D, 0xDE03, '!'
+        };
+        UTF16_CASE(
+            "UTF-16 from ASCII run and multibyte sequences",
+            "ASCII run longer than a vector\xc3\xa9\xe3\x83\x84\xf0\x9f\x98\x83!",
+            40, UTF8CHK_UTF8, 64, UTF8CHK_OK, 40, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 0, 0xD801, 0xDC01, 'b' };
+        UTF16_CASE(
+            "UTF-16 from MUTF-8 surrogate pair",
+            "\xc0\x80\xed\xa0\x81\xed\xb0\x81" "b",
+            9, UTF8CHK_MUTF8, 64, UTF8CHK_OK, 9, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 'a' };
+        UTF16_CASE(
+            "UTF-16 from unpaired high surrogate at end",
+            "a\xed\xa0\x81",
+            4, UTF8CHK_CESU8, 64, UTF8CHK_ERR_SURROGATE_TRUNC, 1, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 'a' };
+        UTF16_CASE(
+            "UTF-16 from surrogate pair into full buffer",
+            "a\xed\xa0\x81\xed\xb0\x81" "b",
+            8, UTF8CHK_CESU8, 2, UTF8CHK_ERR_NO_SPACE, 1, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 'a' };
+        UTF16_CASE(
+            "UTF-16 from four-byte sequence into full buffer",
+            "a\xf0\x9f\x98\x83",
+            5, UTF8CHK_UTF8, 2, UTF8CHK_ERR_NO_SPACE, 1, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 0xFFFF };
+        UTF16_CASE(
+            "UTF-16 from overlong four-byte sequence into counted buffer",
+            "\xf0\x8f\xbf\xbf",
+            4, 0, 1, UTF8CHK_OK, 4, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 0xD800, 0xDC00 };
+        UTF16_CASE(
+            "UTF-16 from surrogate pair with overlong low surrogate",
+            "\xed\xa0\x80\xf0\x8d\xb0\x80",
+            7, UTF8CHK_CHECK_SURROGATES, 2, UTF8CHK_OK, 7, expected
+        );
+    }
+    {
+        static const utf8chk_char16_t expected[] = { 0x0000, 0x0001 };
+        UTF16_CASE(
+            "UTF-16 from overlong four-byte sequences",
+            "\xf0\x80\x80\x80\xf0\x80\x80\x81",
+            8, UTF8CHK_LAX, 64, UTF8CHK_OK, 8, expected
+        );
+    }
+    LATIN1_CASE(
+        "Latin-1 from ASCII run and two-byte sequences",
+        "ASCII run longer than a vector\xc3\xa9\xc2\xa0x\xc3\xbf",
+        37, UTF8CHK_UTF8, 0, 64, UTF8CHK_OK, 37,
+        "ASCII run longer than a vector\xe9\xa0x\xff"
+    );
+    LATIN1_CASE(
+        "Latin-1 up to a code point above U+00FF",
+        "caf\xc3\xa9 \xe6\x97\xa5", UTF8CHK_CSTRING, UTF8CHK_UTF8, 0, 64,
+        UTF8CHK_ERR_UNREPRESENTABLE, 6, "caf\xe9 "
+    );
+    LATIN1_CASE(
+        "ASCII up to a two-byte sequence",
+        "caf\xc3\xa9", 5, UTF8CHK_UTF8, 1, 64,
+        UTF8CHK_ERR_UNREPRESENTABLE, 3, "caf"
+    );
+    LATIN1_CASE(
+        "Latin-1 up to a malformed sequence",
+        "a\xc3(\xe6\x97\xa5", 6, UTF8CHK_UTF8, 0, 64,
+        UTF8CHK_ERR_EXPECTED_CONT, 1, "a"
+    );
+    LATIN1_CASE(
+        "Latin-1 from overlong sequences",
+        "\xc1\xbf\xe0\x83\xa9\xc0\x80", 7, UTF8CHK_LAX, 0, 64,
+        UTF8CHK_OK, 7, "\x7f\xe9\0"
+    );
+    LATIN1_CASE(
+        "Latin-1 up to a surrogate pair",
+        "a\xed\xa0\x81\xed\xb0\x81", 7, UTF8CHK_CESU8, 0, 64,
+        UTF8CHK_ERR_UNREPRESENTABLE, 1, "a"
+    );
+    LATIN1_CASE(
+        "Latin-1 into full buffer",
+        "ab\xc3\xa9", 4, UTF8CHK_UTF8, 0, 2,
+        UTF8CHK_ERR_NO_SPACE, 2, "ab"
+    );
+    {
+        static const utf8chk_error_record_t expected[] = {
+            { 0, 0, UTF8CHK_OK }
+        };
+        ALL_CASE(
+            "All errors in valid string",
+            "abc\xc3\xa9", 5, UTF8CHK_UTF8, 16, 0, expected
+        );
+    }
+    {
+        static const utf8chk_error_record_t expected[] = {
+            { 1, 1, UTF8CHK_ERR_UNEXPECTED_CONT },
+            { 3, 2, UTF8CHK_ERR_EXPECTED_CONT },
+            { 6, 3, UTF8CHK_ERR_OVERLONG },
+            { 10, 3, UTF8CHK_ERR_SURROGATE_TRUNC2 },
+            { 13, 1, UTF8CHK_ERR_TRUNC2 }
+        };
+        ALL_CASE(
+            "All errors in broken CESU-8 string",
+            "a\x80" "b\xe3\x83" "c\xe0\x80\x80" "d\xed\xa0\x81\xe3",
+            14, UTF8CHK_CESU8, 16, 5, expected
+        );
+    }
+    {
+        static const utf8chk_error_record_t expected[] = {
+            { 0, 1, UTF8CHK_ERR_INVALID_START_BYTE },
+            { 1, 1, UTF8CHK_ERR_INVALID_START_BYTE }
+        };
+        ALL_CASE(
+            "All errors with full error list",
+            "\xff\xff\xff\xff", 4, UTF8CHK_UTF8, 2, 4, expected
+        );
+    }
+    {
+        static const utf8chk_error_record_t expected[] = {
+            { 3, 3, UTF8CHK_ERR_SURROGATE_TRUNC }
+        };
+        ALL_CASE(
+            "All errors with unpaired high surrogate at end",
+            "abc\xed\xa0\x81", UTF8CHK_CSTRING, UTF8CHK_MUTF8, 16, 1, expected
+        );
+    }
+    SANITIZE_CASE(
+        "Sanitize valid string",
+        "abc\xc3\xa9\xe3\x83\x84", 8, UTF8CHK_UTF8,
+        "abc\xc3\xa9\xe3\x83\x84", 8, UTF8CHK_ERR_UNEXPECTED_CONT, 0
+    );
+    SANITIZE_CASE(
+        "Sanitize stray bytes",
+        "a\x80" "b\xff", 4, UTF8CHK_UTF8,
+        "a\xef\xbf\xbd" "b\xef\xbf\xbd", 8, UTF8CHK_ERR_UNEXPECTED_CONT, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize overlong sequence by maximal subparts",
+        "\xe0\x80\x80", 3, UTF8CHK_UTF8,
+        "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd", 9,
+        UTF8CHK_ERR_OVERLONG, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize truncated sequences",
+        "\xf0\x9f\x98" "a\xe3\x83", 6, UTF8CHK_UTF8,
+        "\xef\xbf\xbd" "a\xef\xbf\xbd", 7, UTF8CHK_ERR_EXPECTED_CONT, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize surrogate in UTF-8",
+        "\xed\xa0\x80", 3, UTF8CHK_UTF8,
+        "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd", 9,
+        UTF8CHK_ERR_SURROGATE, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize unpaired high surrogates in CESU-8",
+        "\xed\xa0\x81\xed\xa0\x81\xed\xb0\x80\xed\xa0\x81", 12, UTF8CHK_CESU8,
+        "\xef\xbf\xbd\xed\xa0\x81\xed\xb0\x80\xef\xbf\xbd", 12,
+        UTF8CHK_ERR_SURROGATE_HIGH, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize unpaired low surrogate in CESU-8",
+        "a\xed\xb0\x80", 4, UTF8CHK_CESU8,
+        "a\xef\xbf\xbd", 4, UTF8CHK_ERR_SURROGATE_LOW, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize banned noncharacter",
+        "\xf3\xbf\xbf\xbf" "a", 5, UTF8CHK_UTF8 | UTF8CHK_BAN_NONCHARACTERS,
+        "\xef\xbf\xbd" "a", 4, UTF8CHK_ERR_NONCHARACTER, 1
+    );
+    SANITIZE_CASE(
+        "Sanitize banned null byte",
+        "a\0b", 3, UTF8CHK_STRICT,
+        "a\xef\xbf\xbd" "b", 5, UTF8CHK_ERR_NULL_BYTE, 1
+    );
+    {
+        char out[16];
+        size_t out_len;
+        utf8chk_error_t got;
+
+        printf("Test 'Sanitize high surrogate before a bad sequence with "
+               "implicit length'... ");
+        got = utf8chk_sanitize("a\xed\xa0\x81\xe2x", UTF8CHK_CSTRING,
+                               UTF8CHK_CESU8, out, sizeof(out), &out_len,
+                               NULL, NULL, NULL);
+        if (got != UTF8CHK_OK || out_len != 8
+                || memcmp(out, "a\xef\xbf\xbd\xef\xbf\xbdx", 8)) {
+            printf("FAIL (got err=%s, %zu bytes written)\n",
+                   utf8chk_strerr(got), out_len);
+            ++fail;
+        } else {
+            puts("OK");
+        }
+    }
+    {
+        char out[8];
+        const char *error_at;
+        size_t out_len, error_len;
+        utf8chk_error_t got;
+        static const char string[] = "ab\xe3\x83\x84\xff";
+
+        printf("Test 'Sanitize into full buffer'... ");
+        got = utf8chk_sanitize(string, 6, UTF8CHK_UTF8, out, 4, &out_len,
+                               NULL, &error_at, &error_len);
+        if (got != UTF8CHK_ERR_NO_SPACE || out_len != 2
+                || error_at != string + 2 || error_len != 0) {
+            printf("FAIL (got err=%s, %zu bytes written)\n",
+                   utf8chk_strerr(got), out_len);
+            ++fail;
+        } else {
+            puts("OK");
+        }
+    }
+    {
+        char out[8];
+        const char *error_at;
+        size_t out_len, error_len;
+        utf8chk_error_t got;
+        static const char string[] = "ab\xf0\x8d\xa0\x80\xed\xb0\x80" "c";
+
+        printf("Test 'Sanitize overlong surrogate pair into full buffer'... ");
+        got = utf8chk_sanitize(string, 10, UTF8CHK_CHECK_SURROGATES, out, 7,
+                               &out_len, NULL, &error_at, &error_len);
+        if (got != UTF8CHK_ERR_NO_SPACE || out_len != 2
+                || error_at != string + 2 || error_len != 0) {
+            printf("FAIL (got err=%s, %zu bytes written)\n",
+                   utf8chk_strerr(got), out_len);
+            ++fail;
+        } else {
+            puts("OK");
+        }
+    }
+    {
+        static const utf8chk_offset_t valid[] = { 2, 5, 5, 11, 15 };
+        static const utf8chk_offset_t split[] = { 0, 3, 5 };
+        static const utf8chk_offset_t split_empty[] = { 0, 3, 3, 5 };
+        static const utf8chk_offset_t later[] = { 0, 3, 6 };
+        static const utf8chk_offset_t pair[] = { 0, 3, 6 };
+        static const utf8chk_offset_t highs[] = { 0, 3, 9 };
+        static const utf8chk_offset_t overlong_high[] = { 0, 5, 6 };
+        COLUMN_CASE(
+            "Valid column",
+            "--abc\xe6\x97\xa5\xe6\x9c\xac\xc3\xa9xy", valid, UTF8CHK_UTF8,
+            4, UTF8CHK_OK, 0, 0
+        );
+        COLUMN_CASE(
+            "Column string ending inside a sequence",
+            "ab\xc3\xa9x", split, UTF8CHK_UTF8,
+            0, UTF8CHK_ERR_TRUNC, 2, 1
+        );
+        COLUMN_CASE(
+            "Column string ending inside a sequence before an empty string",
+            "ab\xc3\xa9x", split_empty, UTF8CHK_UTF8,
+            0, UTF8CHK_ERR_TRUNC, 2, 1
+        );
+        COLUMN_CASE(
+            "Column error in a later string",
+            "abcd\xff" "e", later, UTF8CHK_UTF8,
+            1, UTF8CHK_ERR_INVALID_START_BYTE, 1, 1
+        );
+        COLUMN_CASE(
+            "Column string starting with a stray continuation byte",
+            "abc\x80" "de", later, UTF8CHK_UTF8,
+            1, UTF8CHK_ERR_UNEXPECTED_CONT, 0, 1
+        );
+        COLUMN_CASE(
+            "Column surrogate pair split between strings",
+            "\xed\xa0\x81\xed\xb0\x80", pair, UTF8CHK_CESU8,
+            0, UTF8CHK_ERR_SURROGATE_TRUNC, 0, 3
+        );
+        COLUMN_CASE(
+            "Column string ending in a high surrogate before another",
+            "\xed\xa0\x81\xed\xa0\x81\xed\xb0\x80", highs, UTF8CHK_CESU8,
+            0, UTF8CHK_ERR_SURROGATE_TRUNC, 0, 3
+        );
+        COLUMN_CASE(
+            "Column string ending in an overlong high surrogate",
+            "a\xf0\x8d\xa0\x80" "b", overlong_high,
+            UTF8CHK_CHECK_SURROGATES, 0, UTF8CHK_ERR_SURROGATE_TRUNC, 1, 4
+        );
+        COLUMN_CASE(
+            "Column surrogates split between strings without checking",
+            "\xed\xa0\x81\xed\xb0\x80", pair, UTF8CHK_WTF8,
+            2, UTF8CHK_OK, 0, 0
+        );
+    }
+    {
+        static const char lines[] = "ab\ncaf\xc3\xa9\n\xe6\x97\xa5\xf0\x9f\x98\x83!";
+        static const char pairs[] = "\xed\xa0\xbd\xed\xb8\x83\n\xed\xa0\xbd\xed\xb8\x83";
+        static const char mixed[] = "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac "
+                "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac "
+                "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac "
+                "caf\xc3\xa9 \xe6\x97\xa5\xe6\x9c\xac\n"
+                "\xf0\x9f\x98\x83 the quick brown fox jumps over the lazy dog "
+                "\xf0\x9f\x98\x83 \xef\xbf\xbe\xff";
+        static const size_t empty_stats[] = { 0, 0, 0, 0, 0, 0, 1, 1, 1 };
+        static const size_t lines_stats[] = { 11, 8, 1, 1, 1, 2, 3, 9, 4 };
+        static const size_t error_stats[] = { 32, 30, 2, 0, 0, 2, 3, 7, 7 };
+        static const size_t cesu8_stats[] = { 3, 1, 0, 4, 0, 1, 2, 7, 2 };
+        static const size_t wtf8_stats[] = { 5, 1, 0, 4, 0, 1, 2, 7, 3 };
+        static const size_t high_stats[] = { 2, 2, 0, 1, 0, 0, 1, 6, 3 };
+        static const size_t overlong_stats[] = { 1, 0, 0, 1, 1, 0, 1, 8, 2 };
+        static const size_t overlong_high_stats[] = {
+            2, 2, 0, 0, 1, 0, 1, 7, 3
+        };
+        static const size_t trunc_stats[] = { 5, 5, 0, 0, 0, 1, 2, 1, 1 };
+        static const size_t cut_stats[] = { 5, 5, 0, 1, 0, 1, 2, 4, 1 };
+        static const size_t mixed_stats[] = { 81, 66, 4, 9, 2, 1, 2, 58, 50 };
+        static const size_t strict_stats[] = { 80, 66, 4, 8, 2, 1, 2, 55, 49 };
+        INFO_CASE(
+            "Info on an empty string",
+            "", 0, UTF8CHK_UTF8,
+            UTF8CHK_OK, 0, empty_stats
+        );
+        INFO_CASE(
+            "Info on lines of text",
+            lines, 17, UTF8CHK_UTF8,
+            UTF8CHK_OK, 17, lines_stats
+        );
+        INFO_CASE(
+            "Info on lines of text with implicit length",
+            lines, UTF8CHK_CSTRING, UTF8CHK_UTF8,
+            UTF8CHK_OK, 17, lines_stats
+        );
+        INFO_CASE(
+            "Info on an error on the third line",
+            "first line\nsecond \xc3\xa9\xc3\xa9 line\nthird \xe3\x83x",
+            UTF8CHK_CSTRING, UTF8CHK_UTF8,
+            UTF8CHK_ERR_EXPECTED_CONT, 34, error_stats
+        );
+        INFO_CASE(
+            "Info on surrogate pairs in CESU-8",
+            pairs, UTF8CHK_CSTRING, UTF8CHK_CESU8,
+            UTF8CHK_OK, 13, cesu8_stats
+        );
+        INFO_CASE(
+            "Info on surrogate pairs in WTF-8",
+            pairs, UTF8CHK_CSTRING, UTF8CHK_WTF8,
+            UTF8CHK_OK, 13, wtf8_stats
+        );
+        INFO_CASE(
+            "Info on a high surrogate left unpaired",
+            "ab\xed\xa0\xbd\xed\xa0\xbd", UTF8CHK_CSTRING, UTF8CHK_CESU8,
+            UTF8CHK_ERR_SURROGATE_HIGH, 5, high_stats
+        );
+        INFO_CASE(
+            "Info on a surrogate pair with an overlong low surrogate",
+            "\xed\xa0\x80\xf0\x8d\xb0\x80", 7, UTF8CHK_CHECK_SURROGATES,
+            UTF8CHK_OK, 7, overlong_stats
+        );
+        INFO_CASE(
+            "Info on an overlong high surrogate left unpaired",
+            "ab\xf0\x8d\xa0\x80\xed\xa0\x80", 9, UTF8CHK_CHECK_SURROGATES,
+            UTF8CHK_ERR_SURROGATE_HIGH, 6, overlong_high_stats
+        );
+        INFO_CASE(
+            "Info on a truncated sequence at the null terminator",
+            "line\n\xe6\x97", UTF8CHK_CSTRING, UTF8CHK_UTF8,
+            UTF8CHK_ERR_TRUNC, 5, trunc_stats
+        );
+        INFO_CASE(
+            "Info on a bad sequence after a high surrogate before the null "
+            "terminator",
+            "line\n\xed\xa0\x81\xe2\xf8", UTF8CHK_CSTRING, UTF8CHK_CESU8,
+            UTF8CHK_ERR_EXPECTED_CONT2, 8, cut_stats
+        );
+        INFO_CASE(
+            "Info on a long line of mixed text",
+            mixed, UTF8CHK_CSTRING, UTF8CHK_UTF8,
+            UTF8CHK_ERR_INVALID_START_BYTE, 109, mixed_stats
+        );
+        INFO_CASE(
+            "Info on a long line of mixed text, strict",
+            mixed, UTF8CHK_CSTRING, UTF8CHK_STRICT,
+            UTF8CHK_ERR_NONCHARACTER, 106, strict_stats
+        );
+    }
+    printf("Test 'Error names'... ");
+    if (strcmp(utf8chk_strerr(UTF8CHK_OK), "UTF8CHK_OK")
+            || strcmp(utf8chk_strerr(UTF8CHK_ERR_SURROGATE_TRUNC3),
+                      "UTF8CHK_ERR_SURROGATE_TRUNC3")
+            || strcmp(utf8chk_strerr(UTF8CHK_ERR_LIMIT), "<\?\?\?>")) {
+        puts("FAIL");
+        ++fail;
+    } else {
+        puts("OK");
+    }
+#ifdef UTF8CHK_STATS
+    {
+        utf8chk_stats_t stats;
+        printf("Test 'Statistics'... ");
+        utf8chk_stats_snapshot(NULL, 1);
+        (void)utf8chk("ab\xc3\xa9", 4, UTF8CHK_UTF8, NULL, NULL);
+        (void)utf8chk("a\x80", UTF8CHK_CSTRING, UTF8CHK_STRICT, NULL, NULL);
+        utf8chk_stats_snapshot(&stats, 1);
+        if (stats.calls != 2 || stats.bytes != 5
+                || stats.ascii_bytes + stats.kernel_bytes
+                    + stats.decoded_bytes != stats.bytes
+                || stats.errors[UTF8CHK_OK] != 1
+                || stats.errors[UTF8CHK_ERR_UNEXPECTED_CONT] != 1) {
+            puts("FAIL");
+            ++fail;
+        } else {
+            utf8chk_stats_snapshot(&stats, 0);
+            if (stats.calls || stats.bytes) {
+                puts("FAIL (not reset)");
+                ++fail;
+            } else {
+                puts("OK");
+            }
+        }
+    }
+#endif
+    if (test_batch("Batch of strings as UTF-8", UTF8CHK_UTF8)) ++fail;
+    if (test_batch("Batch of strings as MUTF-8", UTF8CHK_MUTF8)) ++fail;
+    if (test_batch("Batch of strings as CESU-8", UTF8CHK_CESU8)) ++fail;
+    if (test_batch("Batch of strings, strict", UTF8CHK_STRICT)) ++fail;
+    if (test_batch("Batch of strings, custom flags",
+                   UTF8CHK_BAN_OVERLONG | UTF8CHK_BAN_NULL_BYTE))
+        ++fail;
+    if (test_parallel("Overlong high surrogate before chunk boundary",
+                      "\xf0\x8d\xa0\x80\xed\xb0\x80", 7, 4,
+                      UTF8CHK_CHECK_SURROGATES))
+        ++fail;
+    if (test_parallel("Overlong surrogate pair across chunk boundary",
+                      "\xf0\x8d\xa0\x80\xf0\x8d\xb0\x80", 8, 4,
+                      UTF8CHK_CHECK_SURROGATES))
+        ++fail;
+    if (test_parallel("Error after overlong surrogate pair across chunks",
+                      "\xf0\x8d\xa0\x80\xf0\x8d\xb0\x80\x80", 9, 4,
+                      UTF8CHK_CHECK_SURROGATES))
+        ++fail;
+    if (test_revalidate("Revalidation after edits as UTF-8",
+                        "a\xc3\xa9" "b\xe6\x97\xa5\xf0\x9f\x98\x80"
+                        "cd\xe2\x82\xac", UTF8CHK_UTF8))
+        ++fail;
+    if (test_revalidate("Revalidation after edits as CESU-8",
+                        "a\xed\xa0\xbd\xed\xb8\x80"
+                        "b\xed\xa0\x81" "c"
+                        "\xc3\xa9\xed\xa0\x81\xed\xb0\x80", UTF8CHK_CESU8))
+        ++fail;
+    if (test_revalidate("Revalidation after edits as MUTF-8",
+                        "\xc0\x80\xed\xa0\xbd\xed\xb8\x80\xe6\x97\xa5"
+                        "\xc0\x80", UTF8CHK_MUTF8))
+        ++fail;
+    if (test_revalidate("Revalidation after edits with overlong surrogates",
+                        "a\xf0\x8d\xa0\xbd\xf0\x8d\xb8\x80"
+                        "b\xf0\x8d\xa0\x81" "c"
+                        "\xed\xa0\x81\xf0\x8d\xb0\x80\xf0\x9f\x98\x80",
+                        UTF8CHK_CHECK_SURROGATES))
+        ++fail;
     if (fail)
         printf("%u tests failed.\n", fail);
     else
@@ -487,5 +1875,8 @@ static int run_tests(void) {
 
 int main(int argc, char *argv[]) {
     (void)argc, (void)argv;
+#ifdef UTF8CHK_SIMD
+    printf("Using SIMD kernel: %s\n", utf8chk_simd_name());
+#endif
     return run_tests() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
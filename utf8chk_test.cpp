@@ -0,0 +1,111 @@
+
+#define UTF8CHK_IMPL
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <utility>
+
+#include "utf8chk.hpp"
+
+using utf8chkpp::result;
+using utf8chkpp::validate;
+
+/* validated at compile time. */
+static_assert(validate("").ok());
+static_assert(validate("plain ASCII").ok());
+static_assert(validate("caf\xc3\xa9 \xe6\x97\xa5\xf0\x9f\x98\x83").ok());
+static_assert(validate(u8"café \U0001F603").ok());
+static_assert(validate("ab\x80") == result{ UTF8CHK_ERR_UNEXPECTED_CONT, 2, 1 });
+static_assert(validate("\xe6\x97") == result{ UTF8CHK_ERR_TRUNC, 0, 2 });
+static_assert(validate("\xf0\x9f") == result{ UTF8CHK_ERR_TRUNC2, 0, 2 });
+static_assert(validate("\xe6xy") == result{ UTF8CHK_ERR_EXPECTED_CONT2, 0, 1 });
+static_assert(validate("\xc0\x80") == result{ UTF8CHK_ERR_OVERLONG, 0, 2 });
+static_assert(validate<UTF8CHK_MUTF8>("\xc0\x80").ok());
+static_assert(validate("\xed\xa0\xbd") == result{ UTF8CHK_ERR_SURROGATE, 0, 3 });
+static_assert(validate<UTF8CHK_CESU8>("\xed\xa0\xbd\xed\xb8\x83").ok());
+static_assert(validate<UTF8CHK_CESU8>("x\xed\xa0\xbd")
+              == result{ UTF8CHK_ERR_SURROGATE_TRUNC, 1, 3 });
+static_assert(validate<UTF8CHK_CESU8>("\xed\xa0\xbd\xed\xb8")
+              == result{ UTF8CHK_ERR_SURROGATE_TRUNC, 0, 3 });
+static_assert(validate<UTF8CHK_WTF8>("\xed\xb8\x83").ok());
+static_assert(validate<UTF8CHK_STRICT>("\xef\xbf\xbf")
+              == result{ UTF8CHK_ERR_NONCHARACTER, 0, 3 });
+static_assert(validate<UTF8CHK_STRICT>(std::string_view("a\0b", 3))
+              == result{ UTF8CHK_ERR_NULL_BYTE, 1, 1 });
+
+static constexpr std::array<std::string_view, 3> table = {
+    "key", "\xc3\xa9t\xc3\xa9", "\xe6\x97\xa5\xe6\x9c\xac"
+};
+static_assert(utf8chkpp::all_valid(table));
+static_assert(!utf8chkpp::all_valid(std::array<std::string_view, 2>{
+    "ok", "\xff" }));
+
+/* pieces of text that random test strings are made of. */
+static constexpr std::string_view fragments[] = {
+    "a", "abcdefgh", "\xc3\xa9", "\xe6\x97\xa5", "\xf0\x9f\x98\x83",
+    "\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xf0\x80\x80\x80",
+    "\xed\xa0\xbd", "\xed\xb8\x83", "\xed\xaf\xbf", "\xef\xbf\xbe",
+    "\xef\xb7\x90", "\xef\xb7\xaf", "\xef\xb7\xb0", "\xf4\x8f\xbf\xbf",
+    "\xf4\x90\x80\x80", "\x80", "\xff",
+    "\xe6", "\xf0\x9f", std::string_view("\0", 1)
+};
+
+/* checks that the constexpr loop agrees with utf8chk on the string. */
+template <unsigned Flags>
+static bool agree(std::string_view string) {
+    const char *error_at;
+    std::size_t error_len;
+    utf8chk_error_t err = utf8chk(string.data(), string.size(),
+                                  static_cast<utf8chk_flag_t>(Flags),
+                                  &error_at, &error_len);
+    result expected{ err, static_cast<std::size_t>(error_at - string.data()),
+                     error_len };
+    result compiled = utf8chkpp::detail::check<Flags>(string.data(),
+                                                      string.size());
+
+    if (compiled == expected && validate<Flags>(string) == expected)
+        return true;
+    std::printf("FAIL flags=%u length=%zu: utf8chk %d@%zu+%zu, "
+                "constexpr %d@%zu+%zu\n", Flags, string.size(),
+                expected.error, expected.offset, expected.length,
+                compiled.error, compiled.offset, compiled.length);
+    return false;
+}
+
+template <unsigned... Flags>
+static bool agree_all(std::string_view string,
+                      std::integer_sequence<unsigned, Flags...>) {
+    return (agree<Flags>(string) && ...) && agree<UTF8CHK_STRICT>(string);
+}
+
+int main() {
+    unsigned long seed = 1;
+    unsigned fail = 0;
+    char buffer[64];
+
+    for (int i = 0; i < 20000; ++i) {
+        std::size_t length = 0;
+        std::size_t count;
+        seed = seed * 1103515245UL + 12345UL;
+        count = (seed >> 16) % 8;
+        while (count--) {
+            seed = seed * 1103515245UL + 12345UL;
+            std::string_view fragment
+                    = fragments[(seed >> 16) % std::size(fragments)];
+            if (length + fragment.size() > sizeof(buffer)) break;
+            fragment.copy(buffer + length, fragment.size());
+            length += fragment.size();
+        }
+        if (!agree_all(std::string_view(buffer, length),
+                       std::make_integer_sequence<unsigned, 64>()))
+            ++fail;
+    }
+
+    if (fail)
+        std::printf("%u tests failed.\n", fail);
+    else
+        std::puts("All tests OK.");
+    return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}